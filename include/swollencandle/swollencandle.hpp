@@ -2,16 +2,45 @@
 
 
 #include <algorithm>
+#include <cerrno>
 #include <compare>
+#include <concepts>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <system_error>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <cosevalues/cosevalues.hpp>
 
+#ifdef SWOLLENCANDLE_STD_EXECUTION
+#    include <execution>
+#endif
+
+
+#if !defined(SWOLLENCANDLE_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__GNUC__) || defined(__clang__))
+#    define SWOLLENCANDLE_X86_KERNELS
+#    include <immintrin.h>
+#endif
+
 
 namespace swollencandle {
 
@@ -37,7 +66,7 @@ namespace swollencandle {
 
 
     enum class upscale_period {
-        minute, hour, day, month, year
+        minute, hour, day, month, year, week
     };
 
 
@@ -50,6 +79,8 @@ namespace swollencandle {
             case 4:
                 if(text == "hour")
                     return { upscale_period::hour };
+                if(text == "week")
+                    return { upscale_period::week };
                 if(text == "year")
                     return { upscale_period::year };
                 return std::nullopt;
@@ -67,7 +98,8 @@ namespace swollencandle {
     }
 
 
-    inline std::uint32_t seconds_in(upscale_period up) noexcept {
+    // Nominal length, month and year buckets follow the calendar
+    constexpr std::uint32_t seconds_in(upscale_period up) noexcept {
         switch(up) {
             case upscale_period::minute:
                 return 60u;
@@ -75,6 +107,8 @@ namespace swollencandle {
                 return 3600u;
             case upscale_period::day:
                 return 86400u;
+            case upscale_period::week:
+                return 604800u;
             case upscale_period::month:
                 return 2592000u;
             case upscale_period::year:
@@ -85,10 +119,118 @@ namespace swollencandle {
     }
 
 
+    // Several units of upscale period, e.g. 15 minutes or 4 hours
+    struct timeframe {
+        upscale_period unit{upscale_period::minute};
+        std::uint32_t multiplier{1};
+
+        constexpr timeframe() noexcept = default;
+
+        constexpr timeframe(upscale_period unit, std::uint32_t multiplier = 1) noexcept
+            : unit{unit}, multiplier{multiplier}
+        { }
+
+        bool operator == (timeframe const&) const noexcept = default;
+        bool operator != (timeframe const&) const noexcept = default;
+    };
+
+
+    // Zero when timeframe does not fit into candle period
+    constexpr std::uint32_t seconds_in(timeframe tf) noexcept {
+        auto const seconds = std::uint64_t(seconds_in(tf.unit)) * tf.multiplier;
+        if(seconds > std::numeric_limits<std::uint32_t>::max())
+            return 0u;
+        return std::uint32_t(seconds);
+    }
+
+
+    // Parses "15m", "4h", "1d", "1w", "3M", "1y" and plain upscale period names
+    inline std::optional<timeframe> parse_timeframe(std::string const& text) noexcept {
+        std::uint32_t multiplier = 1;
+        auto const parsed = std::from_chars(text.data(), text.data() + text.size(), multiplier);
+        if(parsed.ptr == text.data()) {
+            auto const maybe_period = parse_upscale_period(text);
+            if(!maybe_period)
+                return std::nullopt;
+            return { timeframe{*maybe_period} };
+        }
+        if(parsed.ec != std::errc{} || multiplier == 0)
+            return std::nullopt;
+        auto const suffix = std::string_view{parsed.ptr, std::size_t(text.data() + text.size() - parsed.ptr)};
+        std::optional<upscale_period> unit;
+        if(suffix == "m" || suffix == "min")
+            unit = upscale_period::minute;
+        else if(suffix == "h")
+            unit = upscale_period::hour;
+        else if(suffix == "d")
+            unit = upscale_period::day;
+        else if(suffix == "w")
+            unit = upscale_period::week;
+        else if(suffix == "M" || suffix == "mo")
+            unit = upscale_period::month;
+        else if(suffix == "y")
+            unit = upscale_period::year;
+        else
+            unit = parse_upscale_period(std::string{suffix});
+        if(!unit)
+            return std::nullopt;
+        timeframe const tf{*unit, multiplier};
+        if(seconds_in(tf) == 0)
+            return std::nullopt;
+        return { tf };
+    }
+
+
+    // UTC offset in seconds effective from time
+    struct offset_transition {
+        std::uint64_t time;
+        std::int32_t utc_offset;
+
+        bool operator == (offset_transition const&) const noexcept = default;
+        bool operator != (offset_transition const&) const noexcept = default;
+    };
+
+
+    // Local time of trading session to align buckets to: fixed UTC offset
+    // or offset transitions of time zone, e.g. daylight saving time changes
+    class session {
+    private:
+        std::int32_t initial_offset_{0};
+        std::vector<offset_transition> transitions_;
+
+    public:
+
+        session() noexcept = default;
+
+        explicit session(std::int32_t utc_offset) noexcept
+            : initial_offset_{utc_offset}
+        { }
+
+        session(std::int32_t initial_offset, std::vector<offset_transition> transitions)
+            : initial_offset_{initial_offset}, transitions_{std::move(transitions)} {
+            std::sort(transitions_.begin(), transitions_.end(),
+                      [](auto const& x, auto const& y) { return x.time < y.time; });
+        }
+
+
+        std::int32_t initial_offset() const noexcept { return initial_offset_; }
+        std::span<offset_transition const> transitions() const noexcept { return transitions_; }
+
+
+        std::int32_t offset_at(std::uint64_t time) const noexcept {
+            auto const after = std::upper_bound(transitions_.begin(), transitions_.end(), time,
+                                                [](std::uint64_t t, auto const& x) { return t < x.time; });
+            return after == transitions_.begin() ? initial_offset_ : std::prev(after)->utc_offset;
+        }
+    }; // session
+
+
+    // Sequence number of exchange, if any, tells apart trades of the same time
     struct trade {
         std::uint64_t time;
         double amount;
         double price;
+        std::uint64_t sequence{0};
 
         bool operator == (trade const&) const noexcept = default;
         bool operator != (trade const&) const noexcept = default;
@@ -105,7 +247,9 @@ namespace swollencandle {
         invalid_candle_fields,
         invalid_trade_fields,
         duplicated_trade,
-        mismatched_trade
+        mismatched_trade,
+        unordered_candles,
+        insufficient_buffer
     };
 
 
@@ -138,6 +282,10 @@ namespace swollencandle {
                     return "Duplicated trade";
                 case error::mismatched_trade:
                     return "Mismatched trade";
+                case error::unordered_candles:
+                    return "Unordered candles";
+                case error::insufficient_buffer:
+                    return "Insufficient output buffer";
                 default:
                     return "Unknown";
             }
@@ -161,291 +309,3058 @@ namespace swollencandle {
         }
 
 
-        bool check_integrity(std::vector<candle> const& candles, std::error_code& ec) noexcept {
-            if(candles.empty())
-                return true;
-            auto last_time = candles.front().time;
-            auto const period = candles.front().period;
-            for(std::size_t i = 1; i != candles.size(); ++i) {
-                auto const& each = candles[i];
-                if(each.period != period)
-                    return detail::failed(ec, make_error_code(error::non_constant_period));
-                last_time = each.time;
+        inline std::size_t default_concurrency() noexcept {
+            auto const n = std::thread::hardware_concurrency();
+            return n == 0 ? 1 : n;
+        }
+
+
+        // Chunks of at least min_size items, zero concurrency is taken as one thread
+        inline std::size_t chunk_count(std::size_t items,
+                                       std::size_t min_size,
+                                       std::size_t concurrency) noexcept {
+            return std::clamp<std::size_t>(items / min_size, 1, std::max<std::size_t>(concurrency, 1));
+        }
+
+
+        // Runs f(0) ... f(tasks - 1) on separate threads, the first one on the calling thread
+        template<typename F>
+        void run_parallel(std::size_t tasks, F const& f) {
+            std::vector<std::exception_ptr> failures(tasks);
+            {
+                std::vector<std::jthread> workers;
+                workers.reserve(tasks);
+                for(std::size_t i = 1; i < tasks; ++i)
+                    workers.emplace_back([&f, &failures, i] {
+                        try {
+                            f(i);
+                        } catch(...) {
+                            failures[i] = std::current_exception();
+                        }
+                    });
+                try {
+                    f(0);
+                } catch(...) {
+                    failures[0] = std::current_exception();
+                }
             }
-            return true;
+            for(auto const& failure: failures)
+                if(failure)
+                    std::rethrow_exception(failure);
         }
 
-    } // detail
 
+        // Weeks start on Monday, 5 January 1970
+        inline constexpr std::uint32_t week_origin = 4 * 86400;
 
-    bool upscale(std::vector<candle> const& source,
-                 std::vector<candle>& result,
-                 upscale_period up,
-                 std::error_code& ec) {
 
-        if(source.empty()) {
-            result.clear();
-            return true;
+        // Buckets start at (time + shift) / length * length - shift
+        constexpr std::uint32_t shift_of(timeframe tf) noexcept {
+            if(tf.unit != upscale_period::week)
+                return 0u;
+            auto const length = seconds_in(tf);
+            return (length - week_origin % length) % length;
         }
 
-        if(!detail::check_integrity(source, ec))
-            return false;
-        auto const period = source.front().period;
-        auto const period_in_seconds = seconds_in(up);
-        if(period_in_seconds % period != 0)
-            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
-        if(period_in_seconds == period) {
-            result.resize(source.size());
-            std::copy(std::begin(source), std::end(source), std::begin(result));
-            return true;
+
+        // Times before the first shifted bucket start fall into the bucket from 0
+        constexpr std::uint64_t floor_shifted(std::uint64_t time, std::uint32_t length,
+                                              std::uint32_t shift) noexcept {
+            auto const start = (time + shift) / length * length;
+            return start < shift ? 0 : start - shift;
         }
-        auto const candles_to_fit = period_in_seconds / period;
-        result.resize(source.size() / candles_to_fit);
-        for(std::size_t i = 0, j = 0; i != result.size(); ++i, j += candles_to_fit) {
-            std::uint64_t count = source[j].count;
-            double volume = source[j].volume;
-            double turnover = source[j].vwap_price * source[j].volume;
-            double high_price = source[j].high_price;
-            double low_price = source[j].low_price;
-            for(auto k = j + 1; k != j + candles_to_fit; ++k) {
-                count += source[k].count;
-                volume += source[k].volume;
-                turnover += source[k].volume * source[k].vwap_price;
-                if(source[k].high_price > high_price)
-                    high_price = source[k].high_price;
-                if(source[k].low_price < low_price)
-                    low_price = source[k].low_price;
-            }
-            result[i] = candle {
-                source[j].time / period_in_seconds * period_in_seconds,
-                period_in_seconds,
-                count,
-                volume,
-                turnover / volume,
-                source[j].open_price,
-                high_price,
-                low_price,
-                source[j + candles_to_fit - 1].close_price
-            };
+
+
+        constexpr std::uint64_t next_shifted(std::uint64_t start, std::uint32_t length,
+                                             std::uint32_t shift) noexcept {
+            return (start + shift) / length * length + length - shift;
         }
-        return true;
-    }
 
 
-    bool merge(std::vector<candle> const& x,
-               std::vector<candle> const& y,
-               std::vector<candle>& z,
-               std::error_code& ec) {
-        if(!x.empty() && !y.empty() && x.front().period != y.front().period)
-            return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
-        std::unordered_map<std::uint64_t, candle const*> indexed;
-        indexed.reserve(x.size() + y.size());
-        for (auto const& each: x) {
-            auto const placed = indexed.try_emplace(each.time, &each);
-            if(!placed.second) {
-                uformat::error("[warning] Candle issue at time ", each.time);
-                return detail::failed(ec, make_error_code(error::duplicated_candle));
-            }
+        constexpr bool valid(timeframe tf) noexcept {
+            return tf.multiplier != 0 && seconds_in(tf) != 0;
         }
-        for (auto const& each: y) {
-            auto const placed = indexed.try_emplace(each.time, &each);
-            if(!placed.second && *placed.first->second != each) {
-                uformat::error("[warning] Candle issue at time ", each.time);
-                return detail::failed(ec, make_error_code(error::mismatched_candles));
-            }
+
+
+        // Proleptic Gregorian calendar, days since 1 January 1970
+        constexpr std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) noexcept {
+            y -= m <= 2;
+            auto const era = (y >= 0 ? y : y - 399) / 400;
+            auto const yoe = unsigned(y - era * 400);
+            auto const doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+            auto const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            return era * 146097 + std::int64_t(doe) - 719468;
         }
-        std::vector<std::pair<std::uint64_t, candle const*>> sorted;
-        sorted.resize(indexed.size());
-        std::size_t i = 0;
-        for (auto const& [time, ptr]: indexed) {
-            sorted[i].first = time;
-            sorted[i].second = ptr;
-            ++i;
+
+
+        // Months since January 1970
+        constexpr std::int64_t month_index_of(std::int64_t days) noexcept {
+            days += 719468;
+            auto const era = (days >= 0 ? days : days - 146096) / 146097;
+            auto const doe = unsigned(days - era * 146097);
+            auto const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            auto const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            auto const mp = (5 * doy + 2) / 153;
+            auto const m = mp < 10 ? mp + 3 : mp - 9;
+            auto const y = std::int64_t(yoe) + era * 400 + (m <= 2);
+            return (y - 1970) * 12 + m - 1;
         }
-        std::sort(sorted.begin(), sorted.end(),
-                  [](auto const& x, auto const& y) { return x.first < y.first; });
-        z.resize(sorted.size());
-        for (i = 0; i != indexed.size(); ++i)
-            z[i] = *sorted[i].second;
-        return true;
-    }
 
 
-    bool upscale(std::vector<trade> const& trades,
-                 std::vector<candle>& result,
-                 upscale_period up,
-                 std::error_code& ec) {
+        constexpr std::uint64_t month_start(std::int64_t month_index) noexcept {
+            auto const y = 1970 + (month_index >= 0 ? month_index : month_index - 11) / 12;
+            auto const m = unsigned(month_index - (y - 1970) * 12) + 1;
+            return std::uint64_t(days_from_civil(y, m, 1)) * 86400;
+        }
 
-        result.clear();
-        if(trades.empty())
-            return true;
 
-        candle candle;
-        auto& first_trade = trades.front();
-        auto const period_in_seconds = seconds_in(up);
-        candle.time = first_trade.time / period_in_seconds * period_in_seconds;
-        candle.period = period_in_seconds;
-        candle.count = 1;
-        candle.volume = first_trade.amount;
-        double turnover = first_trade.amount * first_trade.price;
-        candle.open_price = first_trade.price;
-        candle.high_price = first_trade.price;
-        candle.low_price = first_trade.price;
-        candle.close_price = first_trade.price;
-
-        for(std::size_t i = 1; i != trades.size(); ++i) {
-            auto const& each_trade = trades[i];
-            if(each_trade.time >= candle.time + period_in_seconds) {
-                candle.vwap_price = turnover / candle.volume;
-                result.push_back(candle);
-                candle.time = each_trade.time / period_in_seconds * period_in_seconds;
-                candle.period = period_in_seconds;
-                candle.count = 1;
-                candle.volume = each_trade.amount;
-                turnover = each_trade.amount * each_trade.price;
-                candle.open_price = each_trade.price;
-                candle.high_price = each_trade.price;
-                candle.low_price = each_trade.price;
-                candle.close_price = each_trade.price;
-            } else {
-                ++candle.count;
-                candle.volume += each_trade.amount;
-                turnover += each_trade.price * each_trade.amount;
-                if(each_trade.price > candle.high_price)
-                    candle.high_price = each_trade.price;
-                else if (each_trade.price < candle.low_price)
-                    candle.low_price = each_trade.price;
-                candle.close_price = each_trade.price;
-            }
-        }
-        candle.vwap_price = turnover / candle.volume;
-        result.push_back(candle);
+        // Source candle ends before bucket end, month and year candles keep nominal
+        // period and end on calendar month boundary
+        constexpr bool ends_before(std::uint64_t time, std::uint32_t period,
+                                   std::uint64_t ticks, std::uint64_t bucket_end) noexcept {
+            auto constexpr month = seconds_in(upscale_period::month);
+            if(period % month != 0)
+                return time + period * ticks < bucket_end;
+            auto const index = month_index_of(std::int64_t(time / ticks / 86400));
+            return month_start(index + period / month) * ticks < bucket_end;
+        }
 
-        return true;
-    }
 
+        // Bucket of a runtime length or of several calendar months
+        struct runtime_period {
+            std::uint32_t seconds;
+            std::uint32_t offset{0};
+            std::uint32_t months{0};
 
-    bool merge(std::vector<trade> const& x,
-               std::vector<trade> const& y,
-               std::vector<trade>& z,
-               std::error_code& ec) {
+            std::uint32_t length() const noexcept { return seconds; }
+            std::uint32_t shift() const noexcept { return offset; }
 
-        std::unordered_map<std::uint64_t, trade const*> indexed;
-        indexed.reserve(x.size() + y.size());
-        for (auto const& each: x) {
-            auto const placed = indexed.try_emplace(each.time, &each);
-            if(!placed.second) {
-                uformat::error("[warning] Trade issue at time ", each.time);
-                return detail::failed(ec, make_error_code(error::duplicated_trade));
+            std::uint64_t floor(std::uint64_t time) const noexcept {
+                if(months == 0)
+                    return floor_shifted(time, seconds, offset);
+                auto const index = month_index_of(std::int64_t(time / 86400));
+                return month_start(index - index % months);
             }
-        }
-        for (auto const& each: y) {
-            auto const placed = indexed.try_emplace(each.time, &each);
-            if(!placed.second && *placed.first->second != each) {
-                uformat::error("[warning] Trade issue at time ", each.time);
-                return detail::failed(ec, make_error_code(error::mismatched_trade));
+
+            std::uint64_t next(std::uint64_t start) const noexcept {
+                if(months == 0)
+                    return next_shifted(start, seconds, offset);
+                return month_start(month_index_of(std::int64_t(start / 86400)) + months);
+            }
+
+            // Source candles of the period never straddle two buckets
+            bool accepts(std::uint32_t period) const noexcept {
+                if(months == 0)
+                    return seconds % period == 0 && offset % period == 0;
+                return 86400 % period == 0
+                    || (period % seconds_in(upscale_period::month) == 0 && seconds % period == 0);
+            }
+        };
+
+
+        constexpr std::uint32_t months_of(timeframe tf) noexcept {
+            switch(tf.unit) {
+                case upscale_period::month:
+                    return tf.multiplier;
+                case upscale_period::year:
+                    return 12 * tf.multiplier;
+                default:
+                    return 0u;
             }
         }
-        std::vector<std::pair<std::uint64_t, trade const*>> sorted;
-        sorted.resize(indexed.size());
-        std::size_t i = 0;
-        for (auto const& [time, ptr]: indexed) {
-            sorted[i].first = time;
-            sorted[i].second = ptr;
-            ++i;
+
+
+        constexpr runtime_period period_of(timeframe tf) noexcept {
+            return {seconds_in(tf), shift_of(tf), months_of(tf)};
         }
-        std::sort(sorted.begin(), sorted.end(),
-                  [](auto const& x, auto const& y) { return x.first < y.first; });
-        z.resize(sorted.size());
-        for (i = 0; i != indexed.size(); ++i)
-            z[i] = *sorted[i].second;
-        return true;
-    }
 
-    bool read(std::string const& filename,
-              std::vector<candle>& candles,
-              std::error_code& ec) {
 
-        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
-        if(!maybe_reader)
-            return false;
+        // Bucket length known at compile time, so division is strength-reduced
+        template<std::uint32_t Seconds, std::uint32_t Shift = 0>
+        struct constant_period {
+            static_assert(Seconds != 0);
 
-        auto constexpr line_estimation = 72;
-        candles.clear();
-        candles.reserve(maybe_reader->text_size() / line_estimation + 1);
-        candle candle;
-        for(auto& row: maybe_reader->second_to_last_rows()) {
-            if(!row.parse(candle.time, candle.period, candle.count, candle.volume,
-                          candle.vwap_price, candle.open_price, candle.high_price,
-                          candle.low_price, candle.close_price)) {
-                ec = make_error_code(error::invalid_candle_fields);
-                return false;
+            static constexpr std::uint32_t length() noexcept { return Seconds; }
+            static constexpr std::uint32_t shift() noexcept { return Shift; }
+
+            static constexpr std::uint64_t floor(std::uint64_t time) noexcept {
+                return floor_shifted(time, Seconds, Shift);
             }
-            candles.push_back(candle);
+
+            static constexpr std::uint64_t next(std::uint64_t start) noexcept {
+                return next_shifted(start, Seconds, Shift);
+            }
+
+            static constexpr bool accepts(std::uint32_t period) noexcept {
+                return Seconds % period == 0 && Shift % period == 0;
+            }
+        };
+
+
+        // Calendar buckets precomputed for the time range of the input, floor is
+        // a cursor advance for ascending times
+        class calendar_table {
+        private:
+            runtime_period period_;
+            std::vector<std::uint64_t> bounds_;
+            mutable std::size_t cursor_{0};
+
+        public:
+
+            calendar_table(runtime_period period, std::uint64_t first, std::uint64_t last)
+                : period_{period} {
+                if(first > last)
+                    return;
+                for(auto bound = period.floor(first);; bound = period.next(bound)) {
+                    bounds_.push_back(bound);
+                    if(bound > last)
+                        break;
+                }
+            }
+
+
+            std::uint32_t length() const noexcept { return period_.length(); }
+            std::uint32_t shift() const noexcept { return 0u; }
+            bool accepts(std::uint32_t period) const noexcept { return period_.accepts(period); }
+
+
+            std::uint64_t floor(std::uint64_t time) const noexcept {
+                if(bounds_.size() < 2 || time < bounds_.front() || time >= bounds_.back())
+                    return period_.floor(time);
+                if(time < bounds_[cursor_])
+                    cursor_ = std::size_t(std::upper_bound(bounds_.begin(), bounds_.end(), time)
+                                          - bounds_.begin()) - 1;
+                while(bounds_[cursor_ + 1] <= time)
+                    ++cursor_;
+                return bounds_[cursor_];
+            }
+
+
+            std::uint64_t next(std::uint64_t start) const noexcept {
+                if(cursor_ + 1 < bounds_.size() && bounds_[cursor_] == start)
+                    return bounds_[cursor_ + 1];
+                return period_.next(start);
+            }
+        };
+
+
+        template<typename P>
+        concept bucket_period = requires(P const& period, std::uint64_t time, std::uint32_t source) {
+            { period.length() } -> std::convertible_to<std::uint32_t>;
+            { period.shift() } -> std::convertible_to<std::uint32_t>;
+            { period.floor(time) } -> std::convertible_to<std::uint64_t>;
+            { period.next(time) } -> std::convertible_to<std::uint64_t>;
+            { period.accepts(source) } -> std::convertible_to<bool>;
+        };
+
+
+        // Buckets of the inner period aligned to local time of session,
+        // offsets are looked up by a cursor advancing with time
+        template<bucket_period Inner>
+        class zoned_period {
+        private:
+            Inner inner_;
+            session const* session_;
+            mutable std::size_t cursor_{0};
+
+        public:
+
+            zoned_period(Inner inner, session const& s)
+                : inner_{std::move(inner)}, session_{&s}
+            { }
+
+
+            std::uint32_t length() const noexcept { return inner_.length(); }
+            std::uint32_t shift() const noexcept { return inner_.shift(); }
+
+
+            bool accepts(std::uint32_t period) const noexcept {
+                if(!inner_.accepts(period) || session_->initial_offset() % std::int64_t(period) != 0)
+                    return false;
+                for(auto const& each: session_->transitions())
+                    if(each.utc_offset % std::int64_t(period) != 0)
+                        return false;
+                return true;
+            }
+
+
+            std::uint64_t floor(std::uint64_t time) const noexcept {
+                auto const offset = offset_at(time);
+                auto const local_start = inner_.floor(shifted(time, offset));
+                return shifted(local_start, -offset_at(shifted(local_start, -offset)));
+            }
+
+
+            std::uint64_t next(std::uint64_t start) const noexcept {
+                auto const offset = offset_at(start);
+                auto const local_end = inner_.next(shifted(start, offset));
+                return shifted(local_end, -offset_at(shifted(local_end, -offset)));
+            }
+
+        private:
+
+            static std::uint64_t shifted(std::uint64_t time, std::int32_t offset) noexcept {
+                return std::uint64_t(std::int64_t(time) + offset);
+            }
+
+
+            std::int32_t offset_at(std::uint64_t time) const noexcept {
+                auto const transitions = session_->transitions();
+                if(cursor_ != 0 && time < transitions[cursor_ - 1].time)
+                    cursor_ = std::size_t(std::upper_bound(transitions.begin(), transitions.end(), time,
+                                                           [](std::uint64_t t, auto const& x) {
+                                                               return t < x.time;
+                                                           }) - transitions.begin());
+                while(cursor_ != transitions.size() && transitions[cursor_].time <= time)
+                    ++cursor_;
+                return cursor_ == 0 ? session_->initial_offset() : transitions[cursor_ - 1].utc_offset;
+            }
+        };
+
+
+        // Calls f with the bucket period of timeframe for input within [first, last]
+        template<typename F>
+        bool with_batch_period(timeframe tf, std::uint64_t first, std::uint64_t last, F&& f) {
+            auto const period = period_of(tf);
+            if(period.months == 0)
+                return f(period);
+            return f(calendar_table{period, first, last});
         }
 
-        return true;
-    }
 
+        template<typename Duration>
+        constexpr std::uint64_t ticks_per_second() noexcept {
+            static_assert(Duration::period::num == 1, "Time unit should be a second or a fraction of it");
+            return std::uint64_t(Duration::period::den);
+        }
 
-    bool write(std::string const& filename,
-              std::vector<candle> const& candles,
-              std::error_code& ec) {
-        auto writer = cosevalues::writer();
-        auto constexpr line_estimation = 72;
-        writer.reserve(candles.size() * line_estimation);
-        writer.format("time", "period", "trades", "volume", "vwap_price",
-                      "open_price", "high_price", "low_price", "close_price");
-        for(auto const& candle: candles)
-            writer.format(candle.time, candle.period, candle.count, candle.volume,
-                          candle.vwap_price, candle.open_price, candle.high_price,
-                          candle.low_price, candle.close_price);
-        if(!writer.to_file(filename, ec))
-            return false;
 
-        return true;
-    }
+        template<typename Duration>
+        constexpr std::uint64_t seconds_of(std::uint64_t time) noexcept {
+            return time / ticks_per_second<Duration>();
+        }
 
 
-    bool read(std::string const& filename,
-              std::vector<trade>& trades,
-              std::error_code& ec) {
+        // Inner period over timestamps in 1/Ticks of a second
+        template<bucket_period Inner, std::uint64_t Ticks>
+        struct scaled_period {
+            Inner inner;
 
-        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
-        if(!maybe_reader)
-            return false;
+            static constexpr std::uint64_t ticks = Ticks;
 
-        auto constexpr line_estimation = 32;
-        trades.clear();
-        trades.reserve(maybe_reader->text_size() / line_estimation + 1);
-        trade trade;
-        for(auto& row: maybe_reader->first_to_last_rows()) {
-            if(!row.parse(trade.time, trade.price, trade.amount)) {
-                ec = make_error_code(error::invalid_trade_fields);
-                return false;
+            std::uint32_t length() const noexcept { return inner.length(); }
+            std::uint32_t shift() const noexcept { return inner.shift(); }
+            bool accepts(std::uint32_t period) const noexcept { return inner.accepts(period); }
+
+            std::uint64_t floor(std::uint64_t time) const noexcept {
+                return inner.floor(time / Ticks) * Ticks;
             }
-            trades.push_back(trade);
+
+            std::uint64_t next(std::uint64_t start) const noexcept {
+                return inner.next(start / Ticks) * Ticks;
+            }
+        };
+
+
+        template<typename Duration, bucket_period Period>
+        decltype(auto) scaled(Period const& period) {
+            if constexpr(ticks_per_second<Duration>() == 1)
+                return (period);
+            else
+                return scaled_period<Period, ticks_per_second<Duration>()>{period};
         }
 
-        return true;
-    }
 
+        template<typename Period>
+        constexpr std::uint64_t ticks_of() noexcept {
+            if constexpr(requires { Period::ticks; })
+                return Period::ticks;
+            else
+                return 1;
+        }
 
-    bool write(std::string const& filename,
-               std::vector<trade> const& trades,
-               std::error_code& ec) {
-        auto writer = cosevalues::writer();
-        auto constexpr line_estimation = 72;
-        writer.reserve(trades.size() * line_estimation);
-        for(auto const& trade: trades)
-            writer.format(trade.time, trade.price, trade.amount);
-        if(!writer.to_file(filename, ec))
-            return false;
 
-        return true;
-    }
+        // Local time range of UTC range, UTC offsets are within a day
+        constexpr std::uint64_t local_first(std::uint64_t first) noexcept {
+            return first > 86400 ? first - 86400 : 0;
+        }
+
+
+        constexpr std::uint64_t local_last(std::uint64_t last) noexcept {
+            return last + 86400;
+        }
+
+
+        constexpr bool is_calendar(upscale_period up) noexcept {
+            return up == upscale_period::month || up == upscale_period::year;
+        }
+
+
+        template<upscale_period Up>
+        using constant_period_of = constant_period<seconds_in(Up), shift_of(Up)>;
+
+
+        // Calls f with std::integral_constant of the runtime upscale period
+        template<typename F>
+        bool dispatch(upscale_period up, std::error_code& ec, F&& f) {
+            switch(up) {
+                case upscale_period::minute:
+                    return f(std::integral_constant<upscale_period, upscale_period::minute>{});
+                case upscale_period::hour:
+                    return f(std::integral_constant<upscale_period, upscale_period::hour>{});
+                case upscale_period::day:
+                    return f(std::integral_constant<upscale_period, upscale_period::day>{});
+                case upscale_period::week:
+                    return f(std::integral_constant<upscale_period, upscale_period::week>{});
+                case upscale_period::month:
+                    return f(std::integral_constant<upscale_period, upscale_period::month>{});
+                case upscale_period::year:
+                    return f(std::integral_constant<upscale_period, upscale_period::year>{});
+                default:
+                    return failed(ec, make_error_code(error::invalid_upscale_period));
+            }
+        }
 
 
+        inline bool check_integrity(std::span<candle const> candles, std::error_code& ec) noexcept {
+            if(candles.empty())
+                return true;
+            auto last_time = candles.front().time;
+            auto const period = candles.front().period;
+            for(std::size_t i = 1; i != candles.size(); ++i) {
+                auto const& each = candles[i];
+                if(each.period != period)
+                    return detail::failed(ec, make_error_code(error::non_constant_period));
+                if(each.time <= last_time)
+                    return detail::failed(ec, make_error_code(error::unordered_candles));
+                last_time = each.time;
+            }
+            return true;
+        }
+
+
+        struct bucket_totals {
+            std::uint64_t count;
+            double volume;
+            double turnover;
+            double high_price;
+            double low_price;
+        };
+
+
+        // Candle fields of consecutive rows Stride bytes apart: sizeof(candle)
+        // in candle arrays, sizeof(double) in columns of candle_series
+        template<std::size_t Stride>
+        struct candle_fields {
+            std::uint64_t const* count;
+            double const* volume;
+            double const* vwap_price;
+            double const* high_price;
+            double const* low_price;
+
+            template<typename T>
+            static T const* row(T const* field, std::size_t i) noexcept {
+                return reinterpret_cast<T const*>(reinterpret_cast<char const*>(field) + i * Stride);
+            }
+        };
+
+
+        using candle_rows = candle_fields<sizeof(candle)>;
+        using candle_columns = candle_fields<sizeof(double)>;
+
+
+        inline candle_rows rows_of(candle const* candles) noexcept {
+            return {
+                &candles->count,
+                &candles->volume,
+                &candles->vwap_price,
+                &candles->high_price,
+                &candles->low_price
+            };
+        }
+
+
+        // Adds rows [first, last) to totals, vector kernels finish their tails with it
+        template<std::size_t Stride>
+        void accumulate(bucket_totals& totals,
+                        candle_fields<Stride> const& fields,
+                        std::size_t first,
+                        std::size_t last) noexcept {
+            for(auto i = first; i != last; ++i) {
+                auto const volume = *fields.row(fields.volume, i);
+                auto const high_price = *fields.row(fields.high_price, i);
+                auto const low_price = *fields.row(fields.low_price, i);
+                totals.count += *fields.row(fields.count, i);
+                totals.volume += volume;
+                totals.turnover += volume * *fields.row(fields.vwap_price, i);
+                if(high_price > totals.high_price)
+                    totals.high_price = high_price;
+                if(low_price < totals.low_price)
+                    totals.low_price = low_price;
+            }
+        }
+
+
+        template<std::size_t Stride>
+        bucket_totals reduce_scalar(candle_fields<Stride> const& fields,
+                                    std::size_t first,
+                                    std::size_t last) noexcept {
+            auto const volume = *fields.row(fields.volume, first);
+            bucket_totals totals {
+                *fields.row(fields.count, first),
+                volume,
+                volume * *fields.row(fields.vwap_price, first),
+                *fields.row(fields.high_price, first),
+                *fields.row(fields.low_price, first)
+            };
+            accumulate(totals, fields, first + 1, last);
+            return totals;
+        }
+
+
+#ifdef SWOLLENCANDLE_X86_KERNELS
+
+        // Lanes of rows i, i + 1, ... are loaded from columns and gathered from candle arrays
+
+        template<std::size_t Stride>
+        __attribute__((target("avx2")))
+        inline __m256d load4(double const* field, std::size_t i) noexcept {
+            auto constexpr stride = std::int64_t(Stride);
+            auto const first = candle_fields<Stride>::row(field, i);
+            if constexpr(Stride == sizeof(double))
+                return _mm256_loadu_pd(first);
+            else
+                return _mm256_i64gather_pd(first, _mm256_setr_epi64x(0, stride, 2 * stride, 3 * stride), 1);
+        }
+
+
+        template<std::size_t Stride>
+        __attribute__((target("avx2")))
+        inline __m256i load4(std::uint64_t const* field, std::size_t i) noexcept {
+            auto constexpr stride = std::int64_t(Stride);
+            auto const first = candle_fields<Stride>::row(field, i);
+            if constexpr(Stride == sizeof(std::uint64_t))
+                return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+            else
+                return _mm256_i64gather_epi64(reinterpret_cast<long long const*>(first),
+                                              _mm256_setr_epi64x(0, stride, 2 * stride, 3 * stride), 1);
+        }
+
+
+        template<std::size_t Stride>
+        __attribute__((target("avx2")))
+        bucket_totals reduce_avx2(candle_fields<Stride> const& fields,
+                                  std::size_t first,
+                                  std::size_t last) noexcept {
+            auto constexpr lanes = 4;
+            auto counts = _mm256_setzero_si256();
+            auto volumes = _mm256_setzero_pd();
+            auto turnovers = _mm256_setzero_pd();
+            auto highs = _mm256_set1_pd(*fields.row(fields.high_price, first));
+            auto lows = _mm256_set1_pd(*fields.row(fields.low_price, first));
+            auto i = first;
+            for(; last - i >= lanes; i += lanes) {
+                auto const volume = load4<Stride>(fields.volume, i);
+                counts = _mm256_add_epi64(counts, load4<Stride>(fields.count, i));
+                volumes = _mm256_add_pd(volumes, volume);
+                turnovers = _mm256_add_pd(turnovers,
+                    _mm256_mul_pd(volume, load4<Stride>(fields.vwap_price, i)));
+                highs = _mm256_max_pd(highs, load4<Stride>(fields.high_price, i));
+                lows = _mm256_min_pd(lows, load4<Stride>(fields.low_price, i));
+            }
+            alignas(32) std::uint64_t count_lanes[lanes];
+            alignas(32) double volume_lanes[lanes], turnover_lanes[lanes],
+                               high_lanes[lanes], low_lanes[lanes];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(count_lanes), counts);
+            _mm256_store_pd(volume_lanes, volumes);
+            _mm256_store_pd(turnover_lanes, turnovers);
+            _mm256_store_pd(high_lanes, highs);
+            _mm256_store_pd(low_lanes, lows);
+            bucket_totals totals {0, 0., 0., high_lanes[0], low_lanes[0]};
+            for(auto lane = 0; lane != lanes; ++lane) {
+                totals.count += count_lanes[lane];
+                totals.volume += volume_lanes[lane];
+                totals.turnover += turnover_lanes[lane];
+                if(high_lanes[lane] > totals.high_price)
+                    totals.high_price = high_lanes[lane];
+                if(low_lanes[lane] < totals.low_price)
+                    totals.low_price = low_lanes[lane];
+            }
+            accumulate(totals, fields, i, last);
+            return totals;
+        }
+
+
+        // AVX-512 intrinsics of GCC pass undefined vectors as unused sources
+#    if defined(__GNUC__) && !defined(__clang__)
+#        pragma GCC diagnostic push
+#        pragma GCC diagnostic ignored "-Wuninitialized"
+#        pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#    endif
+
+        template<std::size_t Stride>
+        __attribute__((target("avx512f")))
+        inline __m512d load8(double const* field, std::size_t i) noexcept {
+            auto constexpr stride = std::int64_t(Stride);
+            auto const first = candle_fields<Stride>::row(field, i);
+            if constexpr(Stride == sizeof(double))
+                return _mm512_loadu_pd(first);
+            else
+                return _mm512_i64gather_pd(_mm512_setr_epi64(0, stride, 2 * stride, 3 * stride,
+                                                             4 * stride, 5 * stride, 6 * stride, 7 * stride),
+                                           first, 1);
+        }
+
+
+        template<std::size_t Stride>
+        __attribute__((target("avx512f")))
+        inline __m512i load8(std::uint64_t const* field, std::size_t i) noexcept {
+            auto constexpr stride = std::int64_t(Stride);
+            auto const first = candle_fields<Stride>::row(field, i);
+            if constexpr(Stride == sizeof(std::uint64_t))
+                return _mm512_loadu_si512(first);
+            else
+                return _mm512_i64gather_epi64(_mm512_setr_epi64(0, stride, 2 * stride, 3 * stride,
+                                                                4 * stride, 5 * stride, 6 * stride, 7 * stride),
+                                              first, 1);
+        }
+
+
+        template<std::size_t Stride>
+        __attribute__((target("avx512f")))
+        bucket_totals reduce_avx512(candle_fields<Stride> const& fields,
+                                    std::size_t first,
+                                    std::size_t last) noexcept {
+            auto constexpr lanes = 8;
+            auto counts = _mm512_setzero_si512();
+            auto volumes = _mm512_setzero_pd();
+            auto turnovers = _mm512_setzero_pd();
+            auto highs = _mm512_set1_pd(*fields.row(fields.high_price, first));
+            auto lows = _mm512_set1_pd(*fields.row(fields.low_price, first));
+            auto i = first;
+            for(; last - i >= lanes; i += lanes) {
+                auto const volume = load8<Stride>(fields.volume, i);
+                counts = _mm512_add_epi64(counts, load8<Stride>(fields.count, i));
+                volumes = _mm512_add_pd(volumes, volume);
+                turnovers = _mm512_add_pd(turnovers,
+                    _mm512_mul_pd(volume, load8<Stride>(fields.vwap_price, i)));
+                highs = _mm512_max_pd(highs, load8<Stride>(fields.high_price, i));
+                lows = _mm512_min_pd(lows, load8<Stride>(fields.low_price, i));
+            }
+            bucket_totals totals {
+                std::uint64_t(_mm512_reduce_add_epi64(counts)),
+                _mm512_reduce_add_pd(volumes),
+                _mm512_reduce_add_pd(turnovers),
+                _mm512_reduce_max_pd(highs),
+                _mm512_reduce_min_pd(lows)
+            };
+            accumulate(totals, fields, i, last);
+            return totals;
+        }
+
+#    if defined(__GNUC__) && !defined(__clang__)
+#        pragma GCC diagnostic pop
+#    endif
+
+#endif // SWOLLENCANDLE_X86_KERNELS
+
+
+        template<std::size_t Stride>
+        using reduce_kernel = bucket_totals (*)(candle_fields<Stride> const&,
+                                                std::size_t,
+                                                std::size_t) noexcept;
+
+
+        template<std::size_t Stride>
+        reduce_kernel<Stride> select_reduce_kernel() noexcept {
+#ifdef SWOLLENCANDLE_X86_KERNELS
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f"))
+                return &reduce_avx512<Stride>;
+            if(__builtin_cpu_supports("avx2"))
+                return &reduce_avx2<Stride>;
+#endif
+            return &reduce_scalar<Stride>;
+        }
+
+
+        // Reduces non-empty rows [first, last), vector kernel is chosen once at runtime.
+        // Kernels sum volume and turnover lane by lane, so results of different CPUs
+        // and bucket sizes may differ in the last bits
+        template<std::size_t Stride>
+        bucket_totals reduce(candle_fields<Stride> const& fields,
+                             std::size_t first,
+                             std::size_t last) noexcept {
+            auto constexpr vector_threshold = 8;
+            if(last - first < vector_threshold)
+                return reduce_scalar(fields, first, last);
+            static auto const kernel = select_reduce_kernel<Stride>();
+            return kernel(fields, first, last);
+        }
+
+
+        // Aligns each column allocation to a cache line, allocates from memory
+        // resource if any, from global heap otherwise
+        template<typename T>
+        struct aligned_allocator {
+            using value_type = T;
+
+            static constexpr auto alignment = std::align_val_t{64};
+
+            std::pmr::memory_resource* resource{nullptr};
+
+            aligned_allocator() noexcept = default;
+
+            aligned_allocator(std::pmr::memory_resource* r) noexcept
+                : resource{r}
+            { }
+
+            template<typename U>
+            aligned_allocator(aligned_allocator<U> const& other) noexcept
+                : resource{other.resource}
+            { }
+
+            // Copies are not bound to the arena of original, as with polymorphic_allocator
+            aligned_allocator select_on_container_copy_construction() const noexcept {
+                return {};
+            }
+
+            T* allocate(std::size_t n) {
+                if(resource)
+                    return static_cast<T*>(resource->allocate(n * sizeof(T), std::size_t(alignment)));
+                return static_cast<T*>(::operator new(n * sizeof(T), alignment));
+            }
+
+            void deallocate(T* p, std::size_t n) noexcept {
+                if(resource)
+                    resource->deallocate(p, n * sizeof(T), std::size_t(alignment));
+                else
+                    ::operator delete(p, alignment);
+            }
+
+            template<typename U>
+            bool operator == (aligned_allocator<U> const& other) const noexcept {
+                return resource == other.resource;
+            }
+        };
+
+
+        // Scratch space of merge comes from the resource of polymorphic output
+        template<typename Allocator>
+        std::pmr::memory_resource* scratch_resource(Allocator const& allocator) noexcept {
+            if constexpr(requires { { allocator.resource() } -> std::same_as<std::pmr::memory_resource*>; })
+                return allocator.resource();
+            else if constexpr(requires { { allocator.resource } -> std::convertible_to<std::pmr::memory_resource*>; })
+                return allocator.resource ? allocator.resource : std::pmr::get_default_resource();
+            else
+                return std::pmr::get_default_resource();
+        }
+
+
+        // Calls f(bucket_time, first, last) for each run of source rows sharing a bucket
+        template<bucket_period Period, typename TimeOf, typename F>
+        void for_each_bucket(std::size_t size,
+                             TimeOf const& time_of,
+                             Period const& period,
+                             F&& f) {
+            for(std::size_t j = 0; j != size;) {
+                auto const time = period.floor(time_of(j));
+                auto const bucket_end = period.next(time);
+                auto k = j + 1;
+                while(k != size && time_of(k) < bucket_end)
+                    ++k;
+                f(time, j, k);
+                j = k;
+            }
+        }
+
+
+        // Upper bound of buckets within [first, last], calendar months are 28 days at least
+        template<bucket_period Period>
+        std::size_t bucket_count_bound(std::uint64_t first,
+                                       std::uint64_t last,
+                                       Period const& period) noexcept {
+            auto constexpr month = seconds_in(upscale_period::month);
+            auto length = std::uint64_t(period.length());
+            if(length >= month)
+                length = length / month * 28 * 86400;
+            length *= ticks_of<Period>();
+            return std::size_t((last - first) / length + 2);
+        }
+
+
+        template<bucket_period Period, typename T>
+        std::size_t estimate_bucket_count(T const* items,
+                                          std::size_t size,
+                                          Period const& period) noexcept {
+            if(size == 0)
+                return 0;
+            return std::min(size, bucket_count_bound(items[0].time, items[size - 1].time, period));
+        }
+
+
+        // Writes candles to caller memory, counts the ones not fitted to report required size
+        class span_output {
+        private:
+            std::span<candle> buffer_;
+            std::size_t size_{0};
+            candle back_{};
+
+        public:
+
+            explicit span_output(std::span<candle> buffer) noexcept
+                : buffer_{buffer}
+            { }
+
+            std::size_t size() const noexcept { return size_; }
+            bool fits() const noexcept { return size_ <= buffer_.size(); }
+            candle const& back() const noexcept { return back_; }
+
+            void clear() noexcept { size_ = 0; }
+            void reserve(std::size_t) noexcept { }
+
+            void push_back(candle const& c) noexcept {
+                if(size_ < buffer_.size())
+                    buffer_[size_] = c;
+                back_ = c;
+                ++size_;
+            }
+
+            template<typename It>
+            void assign(It first, It last) noexcept {
+                clear();
+                for(; first != last; ++first)
+                    push_back(*first);
+            }
+        };
+
+    } // detail
+
+
+    // Structure of arrays with one cache line aligned column per candle field
+    class candle_series {
+    public:
+
+        using size_type = std::size_t;
+
+        template<typename T>
+        using column = std::vector<T, detail::aligned_allocator<T>>;
+
+    private:
+        column<std::uint64_t> time_;
+        column<std::uint32_t> period_;
+        column<std::uint64_t> count_;
+        column<double> volume_;
+        column<double> vwap_price_;
+        column<double> open_price_;
+        column<double> high_price_;
+        column<double> low_price_;
+        column<double> close_price_;
+
+    public:
+
+        candle_series() = default;
+        candle_series(candle_series const&) = default;
+        candle_series& operator = (candle_series const&) = default;
+        candle_series(candle_series&&) noexcept = default;
+        candle_series& operator = (candle_series&&) noexcept = default;
+
+        explicit candle_series(std::span<candle const> candles) {
+            assign(candles);
+        }
+
+
+        // Columns are allocated from resource, e.g. monotonic arena of a worker
+        explicit candle_series(std::pmr::memory_resource* resource)
+            : time_{resource}, period_{resource}, count_{resource}, volume_{resource},
+              vwap_price_{resource}, open_price_{resource}, high_price_{resource},
+              low_price_{resource}, close_price_{resource}
+        { }
+
+
+        std::pmr::memory_resource* resource() const noexcept {
+            return detail::scratch_resource(time_.get_allocator());
+        }
+
+
+        size_type size() const noexcept { return time_.size(); }
+        bool empty() const noexcept { return time_.empty(); }
+
+
+        void reserve(size_type n) {
+            time_.reserve(n);
+            period_.reserve(n);
+            count_.reserve(n);
+            volume_.reserve(n);
+            vwap_price_.reserve(n);
+            open_price_.reserve(n);
+            high_price_.reserve(n);
+            low_price_.reserve(n);
+            close_price_.reserve(n);
+        }
+
+
+        void resize(size_type n) {
+            time_.resize(n);
+            period_.resize(n);
+            count_.resize(n);
+            volume_.resize(n);
+            vwap_price_.resize(n);
+            open_price_.resize(n);
+            high_price_.resize(n);
+            low_price_.resize(n);
+            close_price_.resize(n);
+        }
+
+
+        void clear() noexcept {
+            time_.clear();
+            period_.clear();
+            count_.clear();
+            volume_.clear();
+            vwap_price_.clear();
+            open_price_.clear();
+            high_price_.clear();
+            low_price_.clear();
+            close_price_.clear();
+        }
+
+
+        void push_back(candle const& c) {
+            time_.push_back(c.time);
+            period_.push_back(c.period);
+            count_.push_back(c.count);
+            volume_.push_back(c.volume);
+            vwap_price_.push_back(c.vwap_price);
+            open_price_.push_back(c.open_price);
+            high_price_.push_back(c.high_price);
+            low_price_.push_back(c.low_price);
+            close_price_.push_back(c.close_price);
+        }
+
+
+        void set(size_type i, candle const& c) noexcept {
+            time_[i] = c.time;
+            period_[i] = c.period;
+            count_[i] = c.count;
+            volume_[i] = c.volume;
+            vwap_price_[i] = c.vwap_price;
+            open_price_[i] = c.open_price;
+            high_price_[i] = c.high_price;
+            low_price_[i] = c.low_price;
+            close_price_[i] = c.close_price;
+        }
+
+
+        candle operator [] (size_type i) const noexcept {
+            return candle {
+                time_[i],
+                period_[i],
+                count_[i],
+                volume_[i],
+                vwap_price_[i],
+                open_price_[i],
+                high_price_[i],
+                low_price_[i],
+                close_price_[i]
+            };
+        }
+
+
+        void assign(std::span<candle const> candles) {
+            resize(candles.size());
+            for(size_type i = 0; i != candles.size(); ++i)
+                set(i, candles[i]);
+        }
+
+
+        template<typename Allocator>
+        void copy_to(std::vector<candle, Allocator>& candles) const {
+            candles.resize(size());
+            for(size_type i = 0; i != size(); ++i)
+                candles[i] = (*this)[i];
+        }
+
+
+        std::vector<candle> to_vector() const {
+            std::vector<candle> candles;
+            copy_to(candles);
+            return candles;
+        }
+
+
+        std::span<std::uint64_t const> time() const noexcept { return time_; }
+        std::span<std::uint32_t const> period() const noexcept { return period_; }
+        std::span<std::uint64_t const> count() const noexcept { return count_; }
+        std::span<double const> volume() const noexcept { return volume_; }
+        std::span<double const> vwap_price() const noexcept { return vwap_price_; }
+        std::span<double const> open_price() const noexcept { return open_price_; }
+        std::span<double const> high_price() const noexcept { return high_price_; }
+        std::span<double const> low_price() const noexcept { return low_price_; }
+        std::span<double const> close_price() const noexcept { return close_price_; }
+
+        std::span<std::uint64_t> time() noexcept { return time_; }
+        std::span<std::uint32_t> period() noexcept { return period_; }
+        std::span<std::uint64_t> count() noexcept { return count_; }
+        std::span<double> volume() noexcept { return volume_; }
+        std::span<double> vwap_price() noexcept { return vwap_price_; }
+        std::span<double> open_price() noexcept { return open_price_; }
+        std::span<double> high_price() noexcept { return high_price_; }
+        std::span<double> low_price() noexcept { return low_price_; }
+        std::span<double> close_price() noexcept { return close_price_; }
+
+    }; // candle_series
+
+
+    namespace detail {
+
+        inline bool check_integrity(candle_series const& candles, std::error_code& ec) noexcept {
+            if(candles.empty())
+                return true;
+            auto const times = candles.time();
+            auto const periods = candles.period();
+            auto const period = periods.front();
+            for(std::size_t i = 1; i != candles.size(); ++i) {
+                if(periods[i] != period)
+                    return detail::failed(ec, make_error_code(error::non_constant_period));
+                if(times[i] <= times[i - 1])
+                    return detail::failed(ec, make_error_code(error::unordered_candles));
+            }
+            return true;
+        }
+
+
+        // Appends buckets of contiguous time sorted source candles to result
+        template<bucket_period Period, typename Output>
+        void upscale_candles(candle const* source,
+                             std::size_t size,
+                             Period const& period,
+                             Output& result) {
+            auto const period_in_seconds = period.length();
+            auto const time_of = [source](std::size_t i) { return source[i].time; };
+            for_each_bucket(size, time_of, period,
+                            [&](std::uint64_t time, std::size_t j, std::size_t k) {
+                auto const totals = reduce(rows_of(source), j, k);
+                result.push_back(candle {
+                    time,
+                    period_in_seconds,
+                    totals.count,
+                    totals.volume,
+                    totals.turnover / totals.volume,
+                    source[j].open_price,
+                    totals.high_price,
+                    totals.low_price,
+                    source[k - 1].close_price
+                });
+            });
+        }
+
+
+        // Output is std::vector<candle> or span_output, capacity of vector is kept
+        template<bucket_period Period, typename Output>
+        bool upscale_checked(std::span<candle const> source,
+                             Output& result,
+                             Period const& bucket,
+                             bool& partial_tail,
+                             std::error_code& ec) {
+
+            partial_tail = false;
+            result.clear();
+            if(source.empty())
+                return true;
+
+            if(!check_integrity(source, ec))
+                return false;
+            auto const period = source.front().period;
+            if(!bucket.accepts(period))
+                return failed(ec, make_error_code(error::invalid_upscale_period));
+            if(bucket.length() == period) {
+                result.assign(std::begin(source), std::end(source));
+                return true;
+            }
+
+            result.reserve(estimate_bucket_count(source.data(), source.size(), bucket));
+            upscale_candles(source.data(), source.size(), bucket, result);
+            partial_tail = ends_before(source.back().time, period, ticks_of<Period>(),
+                                       bucket.next(result.back().time));
+            return true;
+        }
+
+
+        // Chunk bounds of time sorted items such that no bucket straddles two chunks
+        template<typename T>
+        std::vector<std::size_t> split_at_buckets(std::span<T const> items,
+                                                  std::size_t chunks,
+                                                  runtime_period const& period) {
+            std::vector<std::size_t> bounds(chunks + 1);
+            bounds.back() = items.size();
+            for(std::size_t c = 1; c != chunks; ++c) {
+                auto const& pivot = items[items.size() / chunks * c];
+                auto const bucket_start = period.floor(pivot.time);
+                auto const split = std::partition_point(items.begin() + std::ptrdiff_t(bounds[c - 1]),
+                                                        items.end(),
+                                                        [bucket_start](T const& each) {
+                                                            return each.time < bucket_start;
+                                                        });
+                bounds[c] = std::size_t(split - items.begin());
+            }
+            return bounds;
+        }
+
+
+        template<typename Duration, typename Output>
+        bool upscale_timeframe(std::span<candle const> source,
+                               Output& result,
+                               timeframe tf,
+                               bool& partial_tail,
+                               std::error_code& ec) {
+            if(!valid(tf))
+                return failed(ec, make_error_code(error::invalid_upscale_period));
+            if(source.empty())
+                return upscale_checked(source, result, period_of(tf), partial_tail, ec);
+            return with_batch_period(tf, seconds_of<Duration>(source.front().time),
+                                     seconds_of<Duration>(source.back().time),
+                                     [&](auto const& bucket) {
+                return upscale_checked(source, result, scaled<Duration>(bucket), partial_tail, ec);
+            });
+        }
+
+
+        inline bool fit(span_output const& output, std::size_t& written, std::error_code& ec) noexcept {
+            written = output.size();
+            if(!output.fits())
+                return failed(ec, make_error_code(error::insufficient_buffer));
+            return true;
+        }
+
+
+        template<typename Part>
+        void stitch(std::vector<std::vector<Part>> const& parts, std::vector<Part>& result) {
+            std::size_t total = 0;
+            for(auto const& part: parts)
+                total += part.size();
+            result.clear();
+            result.reserve(total);
+            for(auto const& part: parts)
+                result.insert(result.end(), part.begin(), part.end());
+        }
+
+    } // detail
+
+
+    // Source candles are assigned to target buckets by time, so gaps (holidays,
+    // halts, missing bars) and unaligned first candles need no padding pass.
+    // The trailing bucket is emitted too, partial_tail tells if it is not complete yet.
+    // Candle times are in seconds, timeframe overloads take other units
+    template<upscale_period Up>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle>& result,
+                 bool& partial_tail,
+                 std::error_code& ec) {
+        if constexpr(detail::is_calendar(Up)) {
+            if(source.empty())
+                return detail::upscale_checked(source, result, detail::period_of(Up), partial_tail, ec);
+            detail::calendar_table const bucket{detail::period_of(Up), source.front().time,
+                                                source.back().time};
+            return detail::upscale_checked(source, result, bucket, partial_tail, ec);
+        } else {
+            return detail::upscale_checked(source, result, detail::constant_period_of<Up>{},
+                                           partial_tail, ec);
+        }
+    }
+
+
+    template<upscale_period Up>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle>& result,
+                 std::error_code& ec) {
+        bool partial_tail;
+        return upscale<Up>(source, result, partial_tail, ec);
+    }
+
+
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        upscale_period up,
+                        bool& partial_tail,
+                        std::error_code& ec) {
+        return detail::dispatch(up, ec, [&](auto constant) {
+            return upscale<constant.value>(source, result, partial_tail, ec);
+        });
+    }
+
+
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        upscale_period up,
+                        std::error_code& ec) {
+        bool partial_tail;
+        return upscale(source, result, up, partial_tail, ec);
+    }
+
+
+    // Candle times are in units of Duration (e.g. std::chrono::nanoseconds),
+    // bucket math is scaled at compile time, candle period stays in seconds
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 bool& partial_tail,
+                 std::error_code& ec) {
+        return detail::upscale_timeframe<Duration>(source, result, tf, partial_tail, ec);
+    }
+
+
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 std::error_code& ec) {
+        bool partial_tail;
+        return upscale<Duration>(source, result, tf, partial_tail, ec);
+    }
+
+
+    // Aggregates straight to multi-unit timeframe such as 15 minutes or 4 hours
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        bool& partial_tail,
+                        std::error_code& ec) {
+        if(tf.multiplier == 1)
+            return upscale(source, result, tf.unit, partial_tail, ec);
+        return upscale<std::chrono::seconds>(source, result, tf, partial_tail, ec);
+    }
+
+
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        std::error_code& ec) {
+        bool partial_tail;
+        return upscale(source, result, tf, partial_tail, ec);
+    }
+
+
+    // Upper bound of candle count for upscale of time sorted candles, sizes caller buffers
+    template<typename Duration = std::chrono::seconds>
+    std::size_t estimate_candle_count(std::span<candle const> source, timeframe tf) noexcept {
+        if(!detail::valid(tf))
+            return 0;
+        return detail::estimate_bucket_count(source.data(), source.size(),
+                                             detail::scaled<Duration>(detail::period_of(tf)));
+    }
+
+
+    // Writes to caller provided memory, on insufficient_buffer written is the required size
+    template<typename Duration = std::chrono::seconds>
+    bool upscale(std::span<candle const> source,
+                 std::span<candle> result,
+                 std::size_t& written,
+                 timeframe tf,
+                 bool& partial_tail,
+                 std::error_code& ec) {
+        detail::span_output output{result};
+        written = 0;
+        if(!detail::upscale_timeframe<Duration>(source, output, tf, partial_tail, ec))
+            return false;
+        return detail::fit(output, written, ec);
+    }
+
+
+    template<typename Duration = std::chrono::seconds>
+    bool upscale(std::span<candle const> source,
+                 std::span<candle> result,
+                 std::size_t& written,
+                 timeframe tf,
+                 std::error_code& ec) {
+        bool partial_tail;
+        return upscale<Duration>(source, result, written, tf, partial_tail, ec);
+    }
+
+
+    // Buckets are aligned to local time of session, offsets are applied inline
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 session const& s,
+                 bool& partial_tail,
+                 std::error_code& ec) {
+        if(!detail::valid(tf))
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        if(source.empty())
+            return detail::upscale_checked(source, result, detail::period_of(tf), partial_tail, ec);
+        return detail::with_batch_period(tf,
+                                         detail::local_first(detail::seconds_of<Duration>(source.front().time)),
+                                         detail::local_last(detail::seconds_of<Duration>(source.back().time)),
+                                         [&](auto const& bucket) {
+            return detail::upscale_checked(source, result,
+                                           detail::scaled<Duration>(detail::zoned_period{bucket, s}),
+                                           partial_tail, ec);
+        });
+    }
+
+
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<candle const> source,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 session const& s,
+                 std::error_code& ec) {
+        bool partial_tail;
+        return upscale<Duration>(source, result, tf, s, partial_tail, ec);
+    }
+
+
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        session const& s,
+                        bool& partial_tail,
+                        std::error_code& ec) {
+        return upscale<std::chrono::seconds>(source, result, tf, s, partial_tail, ec);
+    }
+
+
+    inline bool upscale(std::span<candle const> source,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        session const& s,
+                        std::error_code& ec) {
+        bool partial_tail;
+        return upscale(source, result, tf, s, partial_tail, ec);
+    }
+
+
+    // Columnar upscale, streams only time, count, volume, vwap and price columns it needs
+    inline bool upscale(candle_series const& source,
+                        candle_series& result,
+                        upscale_period up,
+                        bool& partial_tail,
+                        std::error_code& ec) {
+
+        partial_tail = false;
+        result.clear();
+        if(source.empty())
+            return true;
+
+        if(!detail::check_integrity(source, ec))
+            return false;
+        auto const period = source.period().front();
+        auto const period_in_seconds = seconds_in(up);
+        if(!detail::period_of(up).accepts(period))
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        if(period_in_seconds == period) {
+            result = source;
+            return true;
+        }
+
+        auto const times = source.time();
+        auto const open_prices = source.open_price();
+        auto const close_prices = source.close_price();
+        detail::candle_columns const columns {
+            source.count().data(),
+            source.volume().data(),
+            source.vwap_price().data(),
+            source.high_price().data(),
+            source.low_price().data()
+        };
+        auto const time_of = [&](std::size_t i) { return times[i]; };
+        return detail::with_batch_period(up, times.front(), times.back(), [&](auto const& bucket) {
+            detail::for_each_bucket(source.size(), time_of, bucket,
+                                    [&](std::uint64_t time, std::size_t j, std::size_t k) {
+                auto const totals = detail::reduce(columns, j, k);
+                result.push_back(candle {
+                    time,
+                    period_in_seconds,
+                    totals.count,
+                    totals.volume,
+                    totals.turnover / totals.volume,
+                    open_prices[j],
+                    totals.high_price,
+                    totals.low_price,
+                    close_prices[k - 1]
+                });
+            });
+            partial_tail = detail::ends_before(times.back(), period, 1,
+                                               bucket.next(result.time().back()));
+            return true;
+        });
+    }
+
+
+    inline bool upscale(candle_series const& source,
+                        candle_series& result,
+                        upscale_period up,
+                        std::error_code& ec) {
+        bool partial_tail;
+        return upscale(source, result, up, partial_tail, ec);
+    }
+
+
+    // Candle times are in seconds
+    inline bool upscale_parallel(std::span<candle const> source,
+                                 std::vector<candle>& result,
+                                 upscale_period up,
+                                 std::size_t concurrency,
+                                 std::error_code& ec) {
+
+        auto constexpr min_chunk_size = std::size_t(1) << 14;
+        auto const chunks = detail::chunk_count(source.size(), min_chunk_size, concurrency);
+        if(chunks == 1)
+            return upscale(source, result, up, ec);
+
+        if(!detail::check_integrity(source, ec))
+            return false;
+        auto const period = source.front().period;
+        if(!detail::period_of(up).accepts(period))
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        if(seconds_in(up) == period) {
+            result.assign(std::begin(source), std::end(source));
+            return true;
+        }
+
+        auto const bounds = detail::split_at_buckets(source, chunks, detail::period_of(up));
+        std::vector<std::vector<candle>> parts(chunks);
+        detail::run_parallel(chunks, [&](std::size_t c) {
+            detail::upscale_candles(source.data() + bounds[c], bounds[c + 1] - bounds[c],
+                                    detail::period_of(up), parts[c]);
+        });
+        detail::stitch(parts, result);
+
+        return true;
+    }
+
+
+    inline bool upscale_parallel(std::span<candle const> source,
+                                 std::vector<candle>& result,
+                                 upscale_period up,
+                                 std::error_code& ec) {
+        return upscale_parallel(source, result, up, detail::default_concurrency(), ec);
+    }
+
+
+    namespace detail {
+
+        // Index of the first time not above the previous one, size if times strictly increase
+        template<typename T>
+        std::size_t first_unordered(std::span<T const> items) noexcept {
+            for(std::size_t i = 1; i < items.size(); ++i)
+                if(items[i].time <= items[i - 1].time)
+                    return i;
+            return items.size();
+        }
+
+
+        template<typename T>
+        bool time_sorted(std::span<T const> items) noexcept {
+            for(std::size_t i = 1; i < items.size(); ++i)
+                if(items[i].time < items[i - 1].time)
+                    return false;
+            return true;
+        }
+
+
+        // Two pointer merge of strictly sorted x and sorted y, entries of y
+        // repeating a time should be equal to the entry already taken
+        template<typename T, typename Output>
+        bool merge_sorted(std::span<T const> x,
+                          std::span<T const> y,
+                          Output& z,
+                          error mismatched,
+                          char const* issue,
+                          std::error_code& ec) {
+            std::size_t i = 0;
+            T const* last = nullptr;
+            for(auto const& each: y) {
+                for(; i != x.size() && x[i].time < each.time; ++i)
+                    z.push_back(x[i]);
+                auto const* taken = i != x.size() && x[i].time == each.time ? &x[i]
+                                  : last != nullptr && last->time == each.time ? last
+                                  : nullptr;
+                if(taken == nullptr) {
+                    z.push_back(each);
+                    last = &each;
+                    continue;
+                }
+                if(*taken != each) {
+                    uformat::error(issue, each.time);
+                    return failed(ec, make_error_code(mismatched));
+                }
+            }
+            for(; i != x.size(); ++i)
+                z.push_back(x[i]);
+            return true;
+        }
+
+
+        // Index of the first item not before time, galloping from the back
+        // so the cost is logarithmic in the distance from the end
+        template<typename T>
+        std::size_t lower_bound_from_back(std::span<T const> items, std::uint64_t time) noexcept {
+            std::size_t last = items.size();
+            std::size_t step = 1;
+            while(step <= last && items[last - step].time >= time) {
+                last -= step;
+                step *= 2;
+            }
+            auto const first = step <= last ? last - step + 1 : 0;
+            auto const found = std::partition_point(items.begin() + std::ptrdiff_t(first),
+                                                    items.begin() + std::ptrdiff_t(last),
+                                                    [time](T const& each) { return each.time < time; });
+            return std::size_t(found - items.begin());
+        }
+
+
+        // Writes items one after another from data
+        template<typename T>
+        struct slice_output {
+            T* data;
+            std::size_t size{0};
+
+            void push_back(T const& each) noexcept {
+                data[size++] = each;
+            }
+        };
+
+
+        // Merge path split points moved back to the first item of their time,
+        // so equal times of x and y always fall into one slice
+        template<typename T>
+        std::vector<std::pair<std::size_t, std::size_t>> split_merge_path(std::span<T const> x,
+                                                                          std::span<T const> y,
+                                                                          std::size_t chunks) {
+            std::vector<std::pair<std::size_t, std::size_t>> bounds(chunks + 1);
+            bounds.back() = {x.size(), y.size()};
+            auto const before = [](T const& each, std::uint64_t time) { return each.time < time; };
+            for(std::size_t c = 1; c != chunks; ++c) {
+                auto const diagonal = (x.size() + y.size()) / chunks * c;
+                auto first = diagonal > y.size() ? diagonal - y.size() : 0;
+                auto last = std::min(diagonal, x.size());
+                while(first < last) {
+                    auto const i = first + (last - first) / 2;
+                    if(x[i].time < y[diagonal - i - 1].time)
+                        first = i + 1;
+                    else
+                        last = i;
+                }
+                auto const i = first;
+                auto const j = diagonal - first;
+                auto const time = i != x.size() && (j == y.size() || x[i].time < y[j].time)
+                                ? x[i].time : y[j].time;
+                auto const x_bound = std::lower_bound(x.begin(), x.end(), time, before) - x.begin();
+                auto const y_bound = std::lower_bound(y.begin(), y.end(), time, before) - y.begin();
+                bounds[c] = {std::max(std::size_t(x_bound), bounds[c - 1].first),
+                             std::max(std::size_t(y_bound), bounds[c - 1].second)};
+            }
+            return bounds;
+        }
+
+
+        // Merges slices of sorted x and y concurrently with merge(x, y, output, ec).
+        // Each slice is written aside from the offset of its inputs, slices are moved
+        // together and swapped in, so z is left unchanged on error
+        template<typename T, typename Allocator, typename Merge>
+        bool merge_slices(std::span<T const> x,
+                          std::span<T const> y,
+                          std::vector<T, Allocator>& z,
+                          std::size_t concurrency,
+                          Merge const& merge,
+                          std::error_code& ec) {
+            auto constexpr min_chunk_size = std::size_t(1) << 16;
+            auto const chunks = chunk_count(x.size() + y.size(), min_chunk_size, concurrency);
+            auto const bounds = split_merge_path(x, y, chunks);
+            auto const merge_slice = [&](std::size_t c, slice_output<T>& output, std::error_code& e) {
+                return merge(x.subspan(bounds[c].first, bounds[c + 1].first - bounds[c].first),
+                             y.subspan(bounds[c].second, bounds[c + 1].second - bounds[c].second),
+                             output, e);
+            };
+            std::vector<T, Allocator> merged(x.size() + y.size(), z.get_allocator());
+            std::vector<std::size_t> sizes(chunks);
+            std::vector<std::error_code> errors(chunks);
+            run_parallel(chunks, [&](std::size_t c) {
+                slice_output<T> writer{merged.data() + bounds[c].first + bounds[c].second};
+                merge_slice(c, writer, errors[c]);
+                sizes[c] = writer.size;
+            });
+            for(auto const& each: errors)
+                if(each)
+                    return failed(ec, each);
+
+            auto size = sizes[0];
+            for(std::size_t c = 1; c != chunks; ++c) {
+                auto const first = merged.begin() + std::ptrdiff_t(bounds[c].first + bounds[c].second);
+                std::copy(first, first + std::ptrdiff_t(sizes[c]), merged.begin() + std::ptrdiff_t(size));
+                size += sizes[c];
+            }
+            merged.resize(size);
+            z.swap(merged);
+            return true;
+        }
+
+    } // detail
+
+
+    // Time sorted inputs are merged in one linear pass, others through index and sort.
+    // Index and sort scratch is allocated from scratch resource
+    template<typename Allocator>
+    bool merge(std::span<candle const> x,
+               std::span<candle const> y,
+               std::vector<candle, Allocator>& z,
+               std::pmr::memory_resource* scratch,
+               std::error_code& ec) {
+        if(!x.empty() && !y.empty() && x.front().period != y.front().period)
+            return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
+        auto const unordered = detail::first_unordered(x);
+        if(unordered != x.size() && x[unordered].time == x[unordered - 1].time) {
+            uformat::error("[warning] Candle issue at time ", x[unordered].time);
+            return detail::failed(ec, make_error_code(error::duplicated_candle));
+        }
+        if(unordered == x.size() && detail::time_sorted(y)) {
+            // Merged aside and swapped in, so z is left unchanged on error
+            std::vector<candle, Allocator> merged(z.get_allocator());
+            merged.reserve(x.size() + y.size());
+            if(!detail::merge_sorted(x, y, merged, error::mismatched_candles,
+                                     "[warning] Candle issue at time ", ec))
+                return false;
+            z.swap(merged);
+            return true;
+        }
+        std::pmr::unordered_map<std::uint64_t, candle const*> indexed(scratch);
+        indexed.reserve(x.size() + y.size());
+        for (auto const& each: x) {
+            auto const placed = indexed.try_emplace(each.time, &each);
+            if(!placed.second) {
+                uformat::error("[warning] Candle issue at time ", each.time);
+                return detail::failed(ec, make_error_code(error::duplicated_candle));
+            }
+        }
+        for (auto const& each: y) {
+            auto const placed = indexed.try_emplace(each.time, &each);
+            if(!placed.second && *placed.first->second != each) {
+                uformat::error("[warning] Candle issue at time ", each.time);
+                return detail::failed(ec, make_error_code(error::mismatched_candles));
+            }
+        }
+        std::pmr::vector<std::pair<std::uint64_t, candle const*>> sorted(scratch);
+        sorted.resize(indexed.size());
+        std::size_t i = 0;
+        for (auto const& [time, ptr]: indexed) {
+            sorted[i].first = time;
+            sorted[i].second = ptr;
+            ++i;
+        }
+        std::sort(sorted.begin(), sorted.end(),
+                  [](auto const& x, auto const& y) { return x.first < y.first; });
+        z.clear();
+        z.reserve(sorted.size());
+        for (auto const& each: sorted)
+            z.push_back(*each.second);
+        return true;
+    }
+
+
+    template<typename Allocator>
+    bool merge(std::span<candle const> x,
+               std::span<candle const> y,
+               std::vector<candle, Allocator>& z,
+               std::error_code& ec) {
+        return merge(x, y, z, detail::scratch_resource(z.get_allocator()), ec);
+    }
+
+
+    // Splits time sorted inputs at common times near merge path diagonals and merges
+    // slices concurrently, the result is identical to merge. Unsorted inputs are merged
+    // sequentially
+    template<typename Allocator>
+    bool merge_parallel(std::span<candle const> x,
+                        std::span<candle const> y,
+                        std::vector<candle, Allocator>& z,
+                        std::size_t concurrency,
+                        std::error_code& ec) {
+        if(!x.empty() && !y.empty() && x.front().period != y.front().period)
+            return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
+        auto const unordered = detail::first_unordered(x);
+        if(unordered != x.size() || !detail::time_sorted(y))
+            return merge(x, y, z, ec);
+        return detail::merge_slices(x, y, z, concurrency,
+                                    [](auto xs, auto ys, auto& output, std::error_code& e) {
+            return detail::merge_sorted(xs, ys, output, error::mismatched_candles,
+                                        "[warning] Candle issue at time ", e);
+        }, ec);
+    }
+
+
+    template<typename Allocator>
+    bool merge_parallel(std::span<candle const> x,
+                        std::span<candle const> y,
+                        std::vector<candle, Allocator>& z,
+                        std::error_code& ec) {
+        return merge_parallel(x, y, z, detail::default_concurrency(), ec);
+    }
+
+
+    // Merges update into time sorted history without duplicates in place, as merge(history,
+    // update) would. Only the overlapping tail is visited, history is left intact on error
+    template<typename Allocator>
+    bool append_merge(std::vector<candle, Allocator>& history,
+                      std::span<candle const> update,
+                      std::error_code& ec) {
+        if(update.empty())
+            return true;
+        if(!history.empty() && history.front().period != update.front().period)
+            return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
+
+        auto* const scratch = detail::scratch_resource(history.get_allocator());
+        std::pmr::vector<candle> sorted(scratch);
+        if(!detail::time_sorted(update)) {
+            sorted.assign(update.begin(), update.end());
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](candle const& x, candle const& y) { return x.time < y.time; });
+            update = sorted;
+        }
+
+        // Candles of update missing in history, in time order
+        std::pmr::vector<candle> fresh(scratch);
+        fresh.reserve(update.size());
+        auto const overlap = detail::lower_bound_from_back(std::span<candle const>{history},
+                                                           update.front().time);
+        auto i = overlap;
+        for(auto const& each: update) {
+            while(i != history.size() && history[i].time < each.time)
+                ++i;
+            auto const* taken = i != history.size() && history[i].time == each.time ? &history[i]
+                              : !fresh.empty() && fresh.back().time == each.time ? &fresh.back()
+                              : nullptr;
+            if(taken == nullptr) {
+                fresh.push_back(each);
+                continue;
+            }
+            if(*taken != each) {
+                uformat::error("[warning] Candle issue at time ", each.time);
+                return detail::failed(ec, make_error_code(error::mismatched_candles));
+            }
+        }
+
+        // Backward merge of fresh candles into the overlapping tail
+        auto h = history.size();
+        auto f = fresh.size();
+        history.resize(h + f);
+        auto out = history.size();
+        while(f != 0) {
+            if(h != overlap && history[h - 1].time > fresh[f - 1].time)
+                history[--out] = history[--h];
+            else
+                history[--out] = fresh[--f];
+        }
+        return true;
+    }
+
+
+    // Merges several sources as a chain of pairwise merges would: the first source
+    // should have no duplicates, the later ones should agree with the earlier ones.
+    // Time sorted sources are merged in one pass over a heap of source heads,
+    // z is left unchanged on error
+    template<typename Allocator>
+    bool merge(std::span<std::vector<candle> const> sources,
+               std::vector<candle, Allocator>& z,
+               std::error_code& ec) {
+        if(sources.empty()) {
+            z.clear();
+            return true;
+        }
+        std::uint32_t period = 0;
+        for(auto const& source: sources) {
+            if(source.empty())
+                continue;
+            if(period != 0 && source.front().period != period)
+                return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
+            period = source.front().period;
+        }
+        std::span<candle const> const first = sources.front();
+        auto const unordered = detail::first_unordered(first);
+        if(unordered != first.size() && first[unordered].time == first[unordered - 1].time) {
+            uformat::error("[warning] Candle issue at time ", first[unordered].time);
+            return detail::failed(ec, make_error_code(error::duplicated_candle));
+        }
+        auto sorted = unordered == first.size();
+        for(std::size_t i = 1; sorted && i != sources.size(); ++i)
+            sorted = detail::time_sorted(std::span<candle const>{sources[i]});
+
+        std::vector<candle, Allocator> merged(z.get_allocator());
+        if(!sorted) {
+            if(!merge(first, std::span<candle const>{}, merged, ec))
+                return false;
+            for(std::size_t i = 1; i != sources.size(); ++i) {
+                std::vector<candle, Allocator> step(z.get_allocator());
+                if(!merge(merged, sources[i], step, ec))
+                    return false;
+                merged.swap(step);
+            }
+            z.swap(merged);
+            return true;
+        }
+
+        struct head {
+            std::uint64_t time;
+            std::size_t source;
+            std::size_t position;
+        };
+        // Among equal times earlier source goes first and is kept
+        auto const later = [](head const& a, head const& b) {
+            return a.time > b.time || (a.time == b.time && a.source > b.source);
+        };
+        std::pmr::vector<head> heads(detail::scratch_resource(z.get_allocator()));
+        heads.reserve(sources.size());
+        std::size_t total = 0;
+        for(std::size_t i = 0; i != sources.size(); ++i) {
+            total += sources[i].size();
+            if(!sources[i].empty())
+                heads.push_back({sources[i].front().time, i, 0});
+        }
+        std::make_heap(heads.begin(), heads.end(), later);
+        merged.reserve(total);
+        while(!heads.empty()) {
+            std::pop_heap(heads.begin(), heads.end(), later);
+            auto& top = heads.back();
+            auto const& source = sources[top.source];
+            auto const& each = source[top.position];
+            if(merged.empty() || merged.back().time != each.time) {
+                merged.push_back(each);
+            } else if(merged.back() != each) {
+                uformat::error("[warning] Candle issue at time ", each.time);
+                return detail::failed(ec, make_error_code(error::mismatched_candles));
+            }
+            if(++top.position == source.size()) {
+                heads.pop_back();
+                continue;
+            }
+            top.time = source[top.position].time;
+            std::push_heap(heads.begin(), heads.end(), later);
+        }
+        z.swap(merged);
+        return true;
+    }
+
+
+    namespace detail {
+
+        // Row of x or y in merge of candle series
+        struct series_row {
+            std::uint64_t time;
+            std::size_t row;
+            bool from_y;
+        };
+
+    } // detail
+
+
+    // Time columns are merged to a sequence of source rows in scratch, linearly when both
+    // are sorted, by stable sort otherwise, then each column is gathered once. Checks and
+    // precedence are those of vectors, z is written after all checks so it is left
+    // unchanged on error
+    inline bool merge(candle_series const& x,
+                      candle_series const& y,
+                      candle_series& z,
+                      std::pmr::memory_resource* scratch,
+                      std::error_code& ec) {
+        if(!x.empty() && !y.empty() && x.period().front() != y.period().front())
+            return detail::failed(ec, make_error_code(error::merging_periods_mismatch));
+        auto const x_time = x.time();
+        auto const y_time = y.time();
+        auto const earlier = [](detail::series_row const& a, detail::series_row const& b) {
+            return a.time < b.time;
+        };
+        std::pmr::vector<detail::series_row> rows(scratch);
+        rows.reserve(x.size() + y.size());
+        if(std::is_sorted(x_time.begin(), x_time.end()) && std::is_sorted(y_time.begin(), y_time.end())) {
+            std::size_t i = 0;
+            for(std::size_t j = 0; j != y.size(); ++j) {
+                for(; i != x.size() && x_time[i] <= y_time[j]; ++i)
+                    rows.push_back({x_time[i], i, false});
+                rows.push_back({y_time[j], j, true});
+            }
+            for(; i != x.size(); ++i)
+                rows.push_back({x_time[i], i, false});
+        } else {
+            for(std::size_t i = 0; i != x.size(); ++i)
+                rows.push_back({x_time[i], i, false});
+            for(std::size_t j = 0; j != y.size(); ++j)
+                rows.push_back({y_time[j], j, true});
+            std::stable_sort(rows.begin(), rows.end(), earlier);
+        }
+
+        // Rows of x go first among equal times, so the kept row is of x if any
+        auto const row_of = [&](detail::series_row const& r) { return r.from_y ? y[r.row] : x[r.row]; };
+        std::size_t size = 0;
+        std::optional<std::uint64_t> mismatched;
+        for(auto const& each: rows) {
+            if(size == 0 || rows[size - 1].time != each.time) {
+                rows[size++] = each;
+                continue;
+            }
+            if(!each.from_y) {
+                uformat::error("[warning] Candle issue at time ", each.time);
+                return detail::failed(ec, make_error_code(error::duplicated_candle));
+            }
+            if(!mismatched && row_of(rows[size - 1]) != row_of(each))
+                mismatched = each.time;
+        }
+        if(mismatched) {
+            uformat::error("[warning] Candle issue at time ", *mismatched);
+            return detail::failed(ec, make_error_code(error::mismatched_candles));
+        }
+
+        z.resize(size);
+        auto const gather = [&](auto const& column_of) {
+            auto const to = column_of(z);
+            auto const from_x = column_of(x);
+            auto const from_y = column_of(y);
+            for(std::size_t i = 0; i != size; ++i)
+                to[i] = rows[i].from_y ? from_y[rows[i].row] : from_x[rows[i].row];
+        };
+        gather([](auto& series) { return series.time(); });
+        gather([](auto& series) { return series.period(); });
+        gather([](auto& series) { return series.count(); });
+        gather([](auto& series) { return series.volume(); });
+        gather([](auto& series) { return series.vwap_price(); });
+        gather([](auto& series) { return series.open_price(); });
+        gather([](auto& series) { return series.high_price(); });
+        gather([](auto& series) { return series.low_price(); });
+        gather([](auto& series) { return series.close_price(); });
+        return true;
+    }
+
+
+    inline bool merge(candle_series const& x,
+                      candle_series const& y,
+                      candle_series& z,
+                      std::error_code& ec) {
+        return merge(x, y, z, z.resource(), ec);
+    }
+
+
+    // Aggregates trades one by one, each finished candle is passed to sink
+    template<typename Sink, detail::bucket_period Period = detail::runtime_period>
+    class candle_builder {
+    private:
+        Sink sink_;
+        Period period_;
+        candle candle_;
+        std::uint64_t bucket_end_{0};
+        double turnover_{0.};
+        bool open_{false};
+
+    public:
+
+        candle_builder(timeframe tf, Sink sink)
+            : sink_{std::move(sink)}, period_{detail::period_of(tf)}
+        { }
+
+
+        candle_builder(Period period, Sink sink)
+            : sink_{std::move(sink)}, period_{period}
+        { }
+
+
+        bool has_open_candle() const noexcept { return open_; }
+        candle const& open_candle() const noexcept { return candle_; }
+        Sink& sink() noexcept { return sink_; }
+
+
+        void push(trade const& each_trade) {
+            if(open_ && each_trade.time < bucket_end_) {
+                ++candle_.count;
+                candle_.volume += each_trade.amount;
+                turnover_ += each_trade.price * each_trade.amount;
+                if(each_trade.price > candle_.high_price)
+                    candle_.high_price = each_trade.price;
+                else if (each_trade.price < candle_.low_price)
+                    candle_.low_price = each_trade.price;
+                candle_.close_price = each_trade.price;
+                return;
+            }
+            flush();
+            candle_.time = period_.floor(each_trade.time);
+            candle_.period = period_.length();
+            bucket_end_ = period_.next(candle_.time);
+            candle_.count = 1;
+            candle_.volume = each_trade.amount;
+            turnover_ = each_trade.amount * each_trade.price;
+            candle_.open_price = each_trade.price;
+            candle_.high_price = each_trade.price;
+            candle_.low_price = each_trade.price;
+            candle_.close_price = each_trade.price;
+            open_ = true;
+        }
+
+
+        // Closes the open candle, if any
+        void flush() {
+            if(!open_)
+                return;
+            candle_.vwap_price = turnover_ / candle_.volume;
+            open_ = false;
+            sink_(std::as_const(candle_));
+        }
+    }; // candle_builder
+
+
+    namespace detail {
+
+        template<bucket_period Period, typename Output>
+        void upscale_trades(std::span<trade const> trades,
+                            Output& result,
+                            Period const& period) {
+            result.clear();
+            result.reserve(estimate_bucket_count(trades.data(), trades.size(), period));
+            candle_builder builder{period, [&result](candle const& each) { result.push_back(each); }};
+            for(auto const& each: trades)
+                builder.push(each);
+            builder.flush();
+        }
+
+
+        template<typename Duration, typename Output>
+        bool upscale_timeframe(std::span<trade const> trades,
+                               Output& result,
+                               timeframe tf,
+                               std::error_code& ec) {
+            if(!valid(tf))
+                return failed(ec, make_error_code(error::invalid_upscale_period));
+            if(trades.empty()) {
+                result.clear();
+                return true;
+            }
+            return with_batch_period(tf, seconds_of<Duration>(trades.front().time),
+                                     seconds_of<Duration>(trades.back().time),
+                                     [&](auto const& bucket) {
+                upscale_trades(trades, result, scaled<Duration>(bucket));
+                return true;
+            });
+        }
+
+    } // detail
+
+
+    // Trade times are in seconds
+    template<upscale_period Up>
+    bool upscale(std::span<trade const> trades,
+                 std::vector<candle>& result,
+                 std::error_code&) {
+        if constexpr(detail::is_calendar(Up)) {
+            if(trades.empty()) {
+                result.clear();
+                return true;
+            }
+            detail::calendar_table const bucket{detail::period_of(Up), trades.front().time,
+                                                trades.back().time};
+            detail::upscale_trades(trades, result, bucket);
+        } else {
+            detail::upscale_trades(trades, result, detail::constant_period_of<Up>{});
+        }
+        return true;
+    }
+
+
+    inline bool upscale(std::span<trade const> trades,
+                        std::vector<candle>& result,
+                        upscale_period up,
+                        std::error_code& ec) {
+        return detail::dispatch(up, ec, [&](auto constant) {
+            return upscale<constant.value>(trades, result, ec);
+        });
+    }
+
+
+    // Trade times are in units of Duration (e.g. std::chrono::nanoseconds),
+    // bucket math is scaled at compile time, candle period stays in seconds
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<trade const> trades,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 std::error_code& ec) {
+        return detail::upscale_timeframe<Duration>(trades, result, tf, ec);
+    }
+
+
+    inline bool upscale(std::span<trade const> trades,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        std::error_code& ec) {
+        if(tf.multiplier == 1)
+            return upscale(trades, result, tf.unit, ec);
+        return upscale<std::chrono::seconds>(trades, result, tf, ec);
+    }
+
+
+    // Upper bound of candle count for upscale of time sorted trades, sizes caller buffers
+    template<typename Duration = std::chrono::seconds>
+    std::size_t estimate_candle_count(std::span<trade const> trades, timeframe tf) noexcept {
+        if(!detail::valid(tf))
+            return 0;
+        return detail::estimate_bucket_count(trades.data(), trades.size(),
+                                             detail::scaled<Duration>(detail::period_of(tf)));
+    }
+
+
+    // Writes to caller provided memory, on insufficient_buffer written is the required size
+    template<typename Duration = std::chrono::seconds>
+    bool upscale(std::span<trade const> trades,
+                 std::span<candle> result,
+                 std::size_t& written,
+                 timeframe tf,
+                 std::error_code& ec) {
+        detail::span_output output{result};
+        written = 0;
+        if(!detail::upscale_timeframe<Duration>(trades, output, tf, ec))
+            return false;
+        return detail::fit(output, written, ec);
+    }
+
+
+    // Buckets are aligned to local time of session, offsets are applied inline
+    template<typename Duration = std::chrono::seconds, typename Allocator>
+    bool upscale(std::span<trade const> trades,
+                 std::vector<candle, Allocator>& result,
+                 timeframe tf,
+                 session const& s,
+                 std::error_code& ec) {
+        if(!detail::valid(tf))
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        if(trades.empty()) {
+            result.clear();
+            return true;
+        }
+        return detail::with_batch_period(tf,
+                                         detail::local_first(detail::seconds_of<Duration>(trades.front().time)),
+                                         detail::local_last(detail::seconds_of<Duration>(trades.back().time)),
+                                         [&](auto const& bucket) {
+            detail::upscale_trades(trades, result,
+                                   detail::scaled<Duration>(detail::zoned_period{bucket, s}));
+            return true;
+        });
+    }
+
+
+    inline bool upscale(std::span<trade const> trades,
+                        std::vector<candle>& result,
+                        timeframe tf,
+                        session const& s,
+                        std::error_code& ec) {
+        return upscale<std::chrono::seconds>(trades, result, tf, s, ec);
+    }
+
+
+    // Streaming builder for trade times in units of Duration
+    template<typename Duration, typename Sink>
+    auto make_candle_builder(timeframe tf, Sink sink) {
+        if constexpr(detail::ticks_per_second<Duration>() == 1)
+            return candle_builder{tf, std::move(sink)};
+        else
+            return candle_builder{detail::scaled_period<detail::runtime_period,
+                                                        detail::ticks_per_second<Duration>()> {
+                                      detail::period_of(tf)
+                                  },
+                                  std::move(sink)};
+    }
+
+
+    // Splits time sorted trades at period boundaries and aggregates chunks concurrently,
+    // the result is identical to the sequential upscale. Trade times are in seconds
+    inline bool upscale_parallel(std::span<trade const> trades,
+                                 std::vector<candle>& result,
+                                 upscale_period up,
+                                 std::size_t concurrency,
+                                 std::error_code& ec) {
+
+        auto constexpr min_chunk_size = std::size_t(1) << 16;
+        auto const chunks = detail::chunk_count(trades.size(), min_chunk_size, concurrency);
+        if(chunks == 1)
+            return upscale(trades, result, up, ec);
+
+        auto const bounds = detail::split_at_buckets(trades, chunks, detail::period_of(up));
+        std::vector<std::vector<candle>> parts(chunks);
+        detail::run_parallel(chunks, [&](std::size_t c) {
+            auto& part = parts[c];
+            candle_builder builder{up, [&part](candle const& each) { part.push_back(each); }};
+            for(auto i = bounds[c]; i != bounds[c + 1]; ++i)
+                builder.push(trades[i]);
+            builder.flush();
+        });
+        detail::stitch(parts, result);
+
+        return true;
+    }
+
+
+    inline bool upscale_parallel(std::span<trade const> trades,
+                                 std::vector<candle>& result,
+                                 upscale_period up,
+                                 std::error_code& ec) {
+        return upscale_parallel(trades, result, up, detail::default_concurrency(), ec);
+    }
+
+
+    namespace detail {
+
+        // Chain of open buckets, each finished bucket rolls into the next coarser one
+        class cascade {
+        private:
+
+            struct level {
+                candle bucket;
+                std::uint64_t bucket_end;
+                double turnover;
+                bool open;
+            };
+
+            std::vector<runtime_period> periods_;
+            std::vector<level> levels_;
+            std::vector<std::vector<candle>>& results_;
+
+        public:
+
+            cascade(std::span<upscale_period const> periods,
+                    std::vector<std::vector<candle>>& results)
+                : levels_(periods.size()), results_{results} {
+                periods_.reserve(periods.size());
+                for(auto const up: periods)
+                    periods_.push_back(period_of(up));
+            }
+
+
+            // At least one period, each one is a multiple of the previous
+            bool nested() const noexcept {
+                if(periods_.empty())
+                    return false;
+                for(std::size_t i = 1; i < periods_.size(); ++i) {
+                    auto const& lower = periods_[i - 1];
+                    auto const& upper = periods_[i];
+                    if(upper.length() <= lower.length() || upper.length() % lower.length() != 0)
+                        return false;
+                    if(upper.shift() % lower.length() != lower.shift())
+                        return false;
+                }
+                return true;
+            }
+
+
+            void add(trade const& each) {
+                add(0, candle {
+                    each.time,
+                    0,
+                    1,
+                    each.amount,
+                    each.price,
+                    each.price,
+                    each.price,
+                    each.price,
+                    each.price
+                }, each.amount * each.price);
+            }
+
+
+            void finish() {
+                for(std::size_t i = 0; i != levels_.size(); ++i)
+                    if(levels_[i].open)
+                        close(i);
+            }
+
+        private:
+
+            void add(std::size_t i, candle const& part, double turnover) {
+                auto& l = levels_[i];
+                auto const& period = periods_[i];
+                if(l.open && part.time < l.bucket_end) {
+                    l.bucket.count += part.count;
+                    l.bucket.volume += part.volume;
+                    l.turnover += turnover;
+                    if(part.high_price > l.bucket.high_price)
+                        l.bucket.high_price = part.high_price;
+                    if(part.low_price < l.bucket.low_price)
+                        l.bucket.low_price = part.low_price;
+                    l.bucket.close_price = part.close_price;
+                    return;
+                }
+                if(l.open)
+                    close(i);
+                l.bucket = part;
+                l.bucket.time = period.floor(part.time);
+                l.bucket.period = period.length();
+                l.bucket_end = period.next(l.bucket.time);
+                l.turnover = turnover;
+                l.open = true;
+            }
+
+
+            void close(std::size_t i) {
+                auto& l = levels_[i];
+                l.bucket.vwap_price = l.turnover / l.bucket.volume;
+                l.open = false;
+                results_[i].push_back(l.bucket);
+                if(i + 1 != levels_.size())
+                    add(i + 1, l.bucket, l.turnover);
+            }
+        }; // cascade
+
+    } // detail
+
+
+    // Fills candles for all nested periods (e.g. minute, hour, day) in one scan over trades.
+    // Coarser periods sum finished candles of the finer one, so their volume and VWAP
+    // equal those of upscale from trades up to rounding. Trade times are in seconds,
+    // on error results are left unchanged
+    inline bool upscale_cascade(std::span<trade const> trades,
+                                std::span<upscale_period const> periods,
+                                std::vector<std::vector<candle>>& results,
+                                std::error_code& ec) {
+        detail::cascade cascade{periods, results};
+        if(!cascade.nested())
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        results.resize(periods.size());
+        for(auto& each: results)
+            each.clear();
+        for(auto const& each: trades)
+            cascade.add(each);
+        cascade.finish();
+        return true;
+    }
+
+
+    namespace detail {
+
+        // Trades are keyed by time and sequence, trades without sequence sharing
+        // the time are keyed by their ordinal within the source
+        struct trade_key {
+            std::uint64_t time;
+            std::uint64_t sequence;
+            std::size_t ordinal;
+
+            auto operator <=> (trade_key const&) const noexcept = default;
+        };
+
+
+        inline bool same_key(trade const& x, trade const& y) noexcept {
+            return x.time == y.time && x.sequence == y.sequence;
+        }
+
+
+        inline bool key_less(trade const& x, trade const& y) noexcept {
+            return x.time < y.time || (x.time == y.time && x.sequence < y.sequence);
+        }
+
+
+        class trade_cursor {
+        private:
+            std::span<trade const> trades_;
+            std::size_t position_{0};
+            std::size_t ordinal_{0};
+
+        public:
+
+            explicit trade_cursor(std::span<trade const> trades) noexcept
+                : trades_{trades}
+            { }
+
+            bool done() const noexcept { return position_ == trades_.size(); }
+            trade const& get() const noexcept { return trades_[position_]; }
+            trade const& previous() const noexcept { return trades_[position_ - 1]; }
+
+            // Same sequence number is seen again
+            bool repeats() const noexcept {
+                return position_ != 0 && get().sequence != 0 && same_key(get(), previous());
+            }
+
+            trade_key key() const noexcept {
+                return {get().time, get().sequence, get().sequence == 0 ? ordinal_ : 0};
+            }
+
+            void next() noexcept {
+                ++position_;
+                if(!done() && same_key(get(), previous()))
+                    ++ordinal_;
+                else
+                    ordinal_ = 0;
+            }
+        };
+
+
+        // Sorts by key in scratch unless already sorted, ordinals are kept by stable sort
+        inline std::span<trade const> key_sorted(std::span<trade const> trades,
+                                                 std::pmr::vector<trade>& scratch) {
+            if(std::is_sorted(trades.begin(), trades.end(), key_less))
+                return trades;
+            scratch.assign(trades.begin(), trades.end());
+            std::stable_sort(scratch.begin(), scratch.end(), key_less);
+            return scratch;
+        }
+
+
+        inline bool check_sequences(std::span<trade const> trades, std::error_code& ec) {
+            for(std::size_t i = 1; i < trades.size(); ++i) {
+                if(trades[i].sequence != 0 && same_key(trades[i], trades[i - 1])) {
+                    uformat::error("[warning] Trade issue at time ", trades[i].time);
+                    return failed(ec, make_error_code(error::duplicated_trade));
+                }
+            }
+            return true;
+        }
+
+
+        // Merges key sorted x and y, trades of y seen before should be equal
+        template<typename Output>
+        bool merge_by_key(std::span<trade const> x,
+                          std::span<trade const> y,
+                          Output& z,
+                          std::error_code& ec) {
+            trade_cursor a{x};
+            trade_cursor b{y};
+            for(; !b.done(); b.next()) {
+                auto const& each = b.get();
+                auto const* taken = b.repeats() ? &b.previous() : nullptr;
+                if(taken == nullptr) {
+                    auto const key = b.key();
+                    for(; !a.done() && a.key() < key; a.next())
+                        z.push_back(a.get());
+                    if(a.done() || key < a.key()) {
+                        z.push_back(each);
+                        continue;
+                    }
+                    taken = &a.get();
+                }
+                if(*taken != each) {
+                    uformat::error("[warning] Trade issue at time ", each.time);
+                    return failed(ec, make_error_code(error::mismatched_trade));
+                }
+            }
+            for(; !a.done(); a.next())
+                z.push_back(a.get());
+            return true;
+        }
+
+    } // detail
+
+
+    // Trades sharing time are told apart by sequence, or by order of appearance when
+    // sequence is zero. Inputs are merged by key without hashing, unsorted ones are
+    // sorted in scratch first
+    template<typename Allocator>
+    bool merge(std::span<trade const> x,
+               std::span<trade const> y,
+               std::vector<trade, Allocator>& z,
+               std::pmr::memory_resource* scratch,
+               std::error_code& ec) {
+
+        std::pmr::vector<trade> x_sorted(scratch);
+        std::pmr::vector<trade> y_sorted(scratch);
+        x = detail::key_sorted(x, x_sorted);
+        y = detail::key_sorted(y, y_sorted);
+        if(!detail::check_sequences(x, ec))
+            return false;
+        // Merged aside and swapped in, so z is left unchanged on error
+        std::vector<trade, Allocator> merged(z.get_allocator());
+        merged.reserve(x.size() + y.size());
+        if(!detail::merge_by_key(x, y, merged, ec))
+            return false;
+        z.swap(merged);
+        return true;
+    }
+
+
+    template<typename Allocator>
+    bool merge(std::span<trade const> x,
+               std::span<trade const> y,
+               std::vector<trade, Allocator>& z,
+               std::error_code& ec) {
+        return merge(x, y, z, detail::scratch_resource(z.get_allocator()), ec);
+    }
+
+
+    // Splits key sorted inputs at common times near merge path diagonals and merges
+    // slices concurrently, the result is identical to merge
+    template<typename Allocator>
+    bool merge_parallel(std::span<trade const> x,
+                        std::span<trade const> y,
+                        std::vector<trade, Allocator>& z,
+                        std::size_t concurrency,
+                        std::error_code& ec) {
+        auto* const scratch = detail::scratch_resource(z.get_allocator());
+        std::pmr::vector<trade> x_sorted(scratch);
+        std::pmr::vector<trade> y_sorted(scratch);
+        x = detail::key_sorted(x, x_sorted);
+        y = detail::key_sorted(y, y_sorted);
+        if(!detail::check_sequences(x, ec))
+            return false;
+        return detail::merge_slices(x, y, z, concurrency,
+                                    [](auto xs, auto ys, auto& output, std::error_code& e) {
+            return detail::merge_by_key(xs, ys, output, e);
+        }, ec);
+    }
+
+
+    template<typename Allocator>
+    bool merge_parallel(std::span<trade const> x,
+                        std::span<trade const> y,
+                        std::vector<trade, Allocator>& z,
+                        std::error_code& ec) {
+        return merge_parallel(x, y, z, detail::default_concurrency(), ec);
+    }
+
+    // Execution policy tags, std::execution policies are accepted too
+    // when SWOLLENCANDLE_STD_EXECUTION is defined
+    namespace execution {
+
+        struct sequenced_policy { };
+        struct unsequenced_policy { };
+        struct parallel_policy { };
+        struct parallel_unsequenced_policy { };
+
+        inline constexpr sequenced_policy seq;
+        inline constexpr unsequenced_policy unseq;
+        inline constexpr parallel_policy par;
+        inline constexpr parallel_unsequenced_policy par_unseq;
+
+
+        template<typename T> struct is_execution_policy : std::false_type { };
+        template<> struct is_execution_policy<sequenced_policy> : std::true_type { };
+        template<> struct is_execution_policy<unsequenced_policy> : std::true_type { };
+        template<> struct is_execution_policy<parallel_policy> : std::true_type { };
+        template<> struct is_execution_policy<parallel_unsequenced_policy> : std::true_type { };
+
+        template<typename T> struct is_parallel_policy : std::false_type { };
+        template<> struct is_parallel_policy<parallel_policy> : std::true_type { };
+        template<> struct is_parallel_policy<parallel_unsequenced_policy> : std::true_type { };
+
+#ifdef SWOLLENCANDLE_STD_EXECUTION
+        template<> struct is_execution_policy<std::execution::sequenced_policy> : std::true_type { };
+        template<> struct is_execution_policy<std::execution::unsequenced_policy> : std::true_type { };
+        template<> struct is_execution_policy<std::execution::parallel_policy> : std::true_type { };
+        template<> struct is_execution_policy<std::execution::parallel_unsequenced_policy>
+            : std::true_type { };
+        template<> struct is_parallel_policy<std::execution::parallel_policy> : std::true_type { };
+        template<> struct is_parallel_policy<std::execution::parallel_unsequenced_policy>
+            : std::true_type { };
+#endif
+
+    } // execution
+
+
+    namespace detail {
+
+        template<typename ExecutionPolicy>
+        constexpr bool is_parallel_policy_v =
+            execution::is_parallel_policy<std::remove_cvref_t<ExecutionPolicy>>::value;
+
+
+        template<typename ExecutionPolicy>
+        concept execution_policy =
+            execution::is_execution_policy<std::remove_cvref_t<ExecutionPolicy>>::value;
+
+    } // detail
+
+
+    // par and par_unseq run on several threads, all policies use vector kernels where available.
+    // Times are in seconds
+
+    template<detail::execution_policy ExecutionPolicy>
+    bool upscale(ExecutionPolicy&&,
+                 std::span<candle const> source,
+                 std::vector<candle>& result,
+                 upscale_period up,
+                 std::error_code& ec) {
+        if constexpr(detail::is_parallel_policy_v<ExecutionPolicy>)
+            return upscale_parallel(source, result, up, ec);
+        else
+            return upscale(source, result, up, ec);
+    }
+
+
+    template<detail::execution_policy ExecutionPolicy>
+    bool upscale(ExecutionPolicy&&,
+                 std::span<trade const> trades,
+                 std::vector<candle>& result,
+                 upscale_period up,
+                 std::error_code& ec) {
+        if constexpr(detail::is_parallel_policy_v<ExecutionPolicy>)
+            return upscale_parallel(trades, result, up, ec);
+        else
+            return upscale(trades, result, up, ec);
+    }
+
+
+    template<detail::execution_policy ExecutionPolicy, typename Allocator>
+    bool merge(ExecutionPolicy&&,
+               std::span<candle const> x,
+               std::span<candle const> y,
+               std::vector<candle, Allocator>& z,
+               std::error_code& ec) {
+        if constexpr(detail::is_parallel_policy_v<ExecutionPolicy>)
+            return merge_parallel(x, y, z, ec);
+        else
+            return merge(x, y, z, ec);
+    }
+
+
+    template<detail::execution_policy ExecutionPolicy, typename Allocator>
+    bool merge(ExecutionPolicy&&,
+               std::span<trade const> x,
+               std::span<trade const> y,
+               std::vector<trade, Allocator>& z,
+               std::error_code& ec) {
+        if constexpr(detail::is_parallel_policy_v<ExecutionPolicy>)
+            return merge_parallel(x, y, z, ec);
+        else
+            return merge(x, y, z, ec);
+    }
+
+
+    namespace detail {
+
+        inline bool parse_record(cosevalues::row& row, candle& candle) {
+            return row.parse(candle.time, candle.period, candle.count, candle.volume,
+                             candle.vwap_price, candle.open_price, candle.high_price,
+                             candle.low_price, candle.close_price);
+        }
+
+
+        inline bool parse_record(cosevalues::row& row, trade& trade) {
+            return row.parse(trade.time, trade.price, trade.amount);
+        }
+
+
+        inline void format_header(cosevalues::writer& writer) {
+            writer.format("time", "period", "trades", "volume", "vwap_price",
+                          "open_price", "high_price", "low_price", "close_price");
+        }
+
+
+        inline void format_record(cosevalues::writer& writer, candle const& candle) {
+            writer.format(candle.time, candle.period, candle.count, candle.volume,
+                          candle.vwap_price, candle.open_price, candle.high_price,
+                          candle.low_price, candle.close_price);
+        }
+
+
+        // Candle files start with a header, trade files do not
+        template<typename Record>
+        struct record_format;
+
+        template<>
+        struct record_format<candle> {
+            static constexpr bool has_header = true;
+            static constexpr auto invalid_fields = error::invalid_candle_fields;
+        };
+
+        template<>
+        struct record_format<trade> {
+            static constexpr bool has_header = false;
+            static constexpr auto invalid_fields = error::invalid_trade_fields;
+        };
+
+    } // detail
+
+
+    template<typename Allocator>
+    bool read(std::string const& filename,
+              std::vector<candle, Allocator>& candles,
+              std::error_code& ec) {
+
+        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
+        if(!maybe_reader)
+            return false;
+
+        auto constexpr line_estimation = 72;
+        candles.clear();
+        candles.reserve(maybe_reader->text_size() / line_estimation + 1);
+        candle candle;
+        for(auto& row: maybe_reader->second_to_last_rows()) {
+            if(!detail::parse_record(row, candle)) {
+                ec = make_error_code(error::invalid_candle_fields);
+                return false;
+            }
+            candles.push_back(candle);
+        }
+
+        return true;
+    }
+
+
+    inline bool write(std::string const& filename,
+                     std::span<candle const> candles,
+                     std::error_code& ec) {
+        auto writer = cosevalues::writer();
+        auto constexpr line_estimation = 72;
+        writer.reserve(candles.size() * line_estimation);
+        detail::format_header(writer);
+        for(auto const& candle: candles)
+            detail::format_record(writer, candle);
+        if(!writer.to_file(filename, ec))
+            return false;
+
+        return true;
+    }
+
+
+    inline bool read(std::string const& filename,
+                     candle_series& candles,
+                     std::error_code& ec) {
+
+        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
+        if(!maybe_reader)
+            return false;
+
+        auto constexpr line_estimation = 72;
+        candles.clear();
+        candles.reserve(maybe_reader->text_size() / line_estimation + 1);
+        candle candle;
+        for(auto& row: maybe_reader->second_to_last_rows()) {
+            if(!detail::parse_record(row, candle)) {
+                ec = make_error_code(error::invalid_candle_fields);
+                return false;
+            }
+            candles.push_back(candle);
+        }
+
+        return true;
+    }
+
+
+    inline bool write(std::string const& filename,
+                      candle_series const& candles,
+                      std::error_code& ec) {
+        auto writer = cosevalues::writer();
+        auto constexpr line_estimation = 72;
+        writer.reserve(candles.size() * line_estimation);
+        detail::format_header(writer);
+        auto const times = candles.time();
+        auto const periods = candles.period();
+        auto const counts = candles.count();
+        auto const volumes = candles.volume();
+        auto const vwap_prices = candles.vwap_price();
+        auto const open_prices = candles.open_price();
+        auto const high_prices = candles.high_price();
+        auto const low_prices = candles.low_price();
+        auto const close_prices = candles.close_price();
+        for(std::size_t i = 0; i != candles.size(); ++i)
+            writer.format(times[i], periods[i], counts[i], volumes[i],
+                          vwap_prices[i], open_prices[i], high_prices[i],
+                          low_prices[i], close_prices[i]);
+        if(!writer.to_file(filename, ec))
+            return false;
+
+        return true;
+    }
+
+
+    template<typename Allocator>
+    bool read(std::string const& filename,
+              std::vector<trade, Allocator>& trades,
+              std::error_code& ec) {
+
+        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
+        if(!maybe_reader)
+            return false;
+
+        auto constexpr line_estimation = 32;
+        trades.clear();
+        trades.reserve(maybe_reader->text_size() / line_estimation + 1);
+        trade trade;
+        for(auto& row: maybe_reader->first_to_last_rows()) {
+            if(!detail::parse_record(row, trade)) {
+                ec = make_error_code(error::invalid_trade_fields);
+                return false;
+            }
+            trades.push_back(trade);
+        }
+
+        return true;
+    }
+
+
+    inline bool write(std::string const& filename,
+                      std::span<trade const> trades,
+                      std::error_code& ec) {
+        auto writer = cosevalues::writer();
+        auto constexpr line_estimation = 72;
+        writer.reserve(trades.size() * line_estimation);
+        for(auto const& trade: trades)
+            writer.format(trade.time, trade.price, trade.amount);
+        if(!writer.to_file(filename, ec))
+            return false;
+
+        return true;
+    }
+
+
+
+
+    namespace detail {
+
+        inline bool blank(std::string_view text) noexcept {
+            return text.find_first_not_of(" \t\r") == std::string_view::npos;
+        }
+
+
+        // Rows of text starting at row boundary, trailing blanks are not a row
+        inline std::size_t count_rows(std::string_view text, bool last) noexcept {
+            auto const lines = std::size_t(std::count(text.begin(), text.end(), '\n'));
+            if(!last)
+                return lines;
+            auto const tail = text.substr(text.rfind('\n') + 1);
+            return lines + (blank(tail) ? 0 : 1);
+        }
+
+    } // detail
+
+
+    // Splits text at line ends and parses slices concurrently straight into their
+    // places in records. Quoted fields can not span lines (row parsing stops at '\n'
+    // inside quotes), so every line end is a row boundary. As with read, records
+    // keep the rows before the first bad one on error
+    template<typename Record, typename Allocator>
+    bool read_parallel(std::string const& filename,
+                       std::vector<Record, Allocator>& records,
+                       std::size_t concurrency,
+                       std::error_code& ec) {
+        auto maybe_reader = cosevalues::reader::from_file(filename, ec);
+        if(!maybe_reader)
+            return false;
+        auto text = maybe_reader->text();
+        if constexpr(detail::record_format<Record>::has_header) {
+            auto const header_end = text.find('\n');
+            text.remove_prefix(header_end == std::string_view::npos ? text.size() : header_end + 1);
+        }
+
+        auto constexpr min_chunk_size = std::size_t(1) << 20;
+        auto const chunks = detail::chunk_count(text.size(), min_chunk_size, concurrency);
+        std::vector<std::size_t> bounds(chunks + 1);
+        bounds.back() = text.size();
+        for(std::size_t c = 1; c != chunks; ++c) {
+            auto const line_end = text.find('\n', std::max(text.size() / chunks * c, bounds[c - 1]));
+            bounds[c] = line_end == std::string_view::npos ? text.size() : line_end + 1;
+        }
+        auto const slice = [&](std::size_t c) {
+            return text.substr(bounds[c], bounds[c + 1] - bounds[c]);
+        };
+
+        std::vector<std::size_t> offsets(chunks + 1);
+        detail::run_parallel(chunks, [&](std::size_t c) {
+            offsets[c + 1] = detail::count_rows(slice(c), c + 1 == chunks);
+        });
+        for(std::size_t c = 0; c != chunks; ++c)
+            offsets[c + 1] += offsets[c];
+        records.resize(offsets.back());
+
+        auto const no_error = std::numeric_limits<std::size_t>::max();
+        std::vector<std::size_t> bad_rows(chunks, no_error);
+        detail::run_parallel(chunks, [&](std::size_t c) {
+            auto const part = slice(c);
+            auto it = cosevalues::reader::rows_between(part.data(), part.data() + part.size()).begin();
+            for(auto i = offsets[c]; i != offsets[c + 1]; ++i, ++it) {
+                if(!detail::parse_record(*it, records[i])) {
+                    bad_rows[c] = i;
+                    return;
+                }
+            }
+        });
+        for(auto const bad_row: bad_rows) {
+            if(bad_row != no_error) {
+                records.resize(bad_row);
+                return detail::failed(ec, make_error_code(detail::record_format<Record>::invalid_fields));
+            }
+        }
+        return true;
+    }
+
+
+    template<typename Record, typename Allocator>
+    bool read_parallel(std::string const& filename,
+                       std::vector<Record, Allocator>& records,
+                       std::error_code& ec) {
+        return read_parallel(filename, records, detail::default_concurrency(), ec);
+    }
+
+
+    template<detail::execution_policy ExecutionPolicy, typename Record, typename Allocator>
+    bool read(ExecutionPolicy&&,
+              std::string const& filename,
+              std::vector<Record, Allocator>& records,
+              std::error_code& ec) {
+        if constexpr(detail::is_parallel_policy_v<ExecutionPolicy>)
+            return read_parallel(filename, records, ec);
+        else
+            return read(filename, records, ec);
+    }
+
+
+    // Reads candles or trades from file in batches of bounded size through a sliding
+    // buffer, so memory does not depend on file size. Rows split between chunks are
+    // carried over, a row longer than the buffer grows it
+    template<typename Record>
+    class batch_reader {
+    public:
+
+        using size_type = std::size_t;
+
+        static constexpr size_type default_batch_size = size_type(1) << 16;
+        static constexpr size_type chunk_size = size_type(1) << 20;
+
+    private:
+        std::unique_ptr<FILE, int (*)(FILE*)> file_{nullptr, fclose};
+        std::vector<char> buffer_;
+        std::vector<Record> batch_;
+        size_type batch_size_{default_batch_size};
+        size_type parsed_{0};
+        size_type complete_{0};
+        size_type filled_{0};
+        char saved_{'\0'};
+        bool eof_{false};
+
+    public:
+
+        static std::optional<batch_reader> from_file(std::string const& filename,
+                                                     std::error_code& ec,
+                                                     size_type batch_size = default_batch_size) {
+            batch_reader r;
+            r.file_.reset(std::fopen(filename.c_str(), "rb"));
+            if(!r.file_) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                return std::nullopt;
+            }
+            r.batch_size_ = batch_size == 0 ? 1 : batch_size;
+            r.batch_.reserve(r.batch_size_);
+            r.buffer_.resize(chunk_size + 1);
+            if(!r.refill(ec))
+                return std::nullopt;
+            if constexpr(detail::record_format<Record>::has_header) {
+                auto const* const text = r.buffer_.data();
+                auto const* const header_end = static_cast<char const*>(
+                    std::memchr(text, '\n', r.complete_));
+                r.parsed_ = header_end == nullptr ? r.complete_ : size_type(header_end - text) + 1;
+            }
+            return { std::move(r) };
+        }
+
+
+        // False on error (ec is set then), batch is empty at the end of file
+        // and stays valid until the next call
+        bool next(std::span<Record const>& batch, std::error_code& ec) {
+            batch_.clear();
+            while(batch_.size() != batch_size_) {
+                if(parsed_ == complete_) {
+                    if(eof_ && complete_ == filled_)
+                        break;
+                    if(!refill(ec))
+                        return false;
+                    continue;
+                }
+                auto const rows = cosevalues::reader::rows_between(buffer_.data() + parsed_,
+                                                                   buffer_.data() + complete_);
+                auto it = rows.begin();
+                for(; it != rows.end() && batch_.size() != batch_size_; ++it) {
+                    Record record;
+                    if(!detail::parse_record(*it, record))
+                        return detail::failed(ec, make_error_code(detail::record_format<Record>::invalid_fields));
+                    batch_.push_back(record);
+                }
+                parsed_ = size_type(it.position() - buffer_.data());
+            }
+            batch = batch_;
+            return true;
+        }
+
+    private:
+
+        batch_reader() = default;
+
+
+        // Moves the unparsed tail to the front and reads until a complete row or end of file,
+        // complete rows are terminated with '\0' for the row parser
+        bool refill(std::error_code& ec) {
+            buffer_[complete_] = saved_;
+            std::memmove(buffer_.data(), buffer_.data() + parsed_, filled_ - parsed_);
+            filled_ -= parsed_;
+            parsed_ = 0;
+            complete_ = 0;
+            for(;;) {
+                if(filled_ == buffer_.size() - 1)
+                    buffer_.resize(buffer_.size() * 2);
+                auto const wanted = buffer_.size() - 1 - filled_;
+                auto const bytes_read = std::fread(buffer_.data() + filled_, 1, wanted, file_.get());
+                if(bytes_read != wanted) {
+                    if(std::ferror(file_.get()))
+                        return detail::failed(ec, std::make_error_code(std::errc::io_error));
+                    eof_ = true;
+                }
+                auto const searched = filled_;
+                filled_ += bytes_read;
+                for(auto i = filled_; i != searched; --i)
+                    if(buffer_[i - 1] == '\n') {
+                        complete_ = i;
+                        break;
+                    }
+                if(complete_ != 0 || eof_)
+                    break;
+            }
+            if(eof_)
+                complete_ = filled_;
+            saved_ = buffer_[complete_];
+            buffer_[complete_] = '\0';
+            return true;
+        }
+    }; // batch_reader
+
+
+
+    // Trades file is parsed in batches, aggregated and formatted to candles file
+    // in one pass, neither trades nor output text are held in memory as a whole.
+    // Trade times are in units of Duration
+    template<typename Duration = std::chrono::seconds>
+    bool upscale_file(std::string const& input,
+                      std::string const& output,
+                      timeframe tf,
+                      std::error_code& ec) {
+        if(!detail::valid(tf))
+            return detail::failed(ec, make_error_code(error::invalid_upscale_period));
+        auto reader = batch_reader<trade>::from_file(input, ec);
+        if(!reader)
+            return false;
+        std::unique_ptr<FILE, int (*)(FILE*)> file{std::fopen(output.c_str(), "wb"), fclose};
+        if(!file) {
+            ec = std::make_error_code(static_cast<std::errc>(errno));
+            return false;
+        }
+
+        auto constexpr flush_size = std::size_t(1) << 20;
+        cosevalues::writer writer;
+        writer.reserve(flush_size + 4096);
+        detail::format_header(writer);
+        std::error_code write_ec;
+        auto builder = make_candle_builder<Duration>(tf, [&](candle const& each) {
+            detail::format_record(writer, each);
+            if(writer.size() >= flush_size && !write_ec)
+                writer.flush_to(file.get(), write_ec);
+        });
+
+        std::span<trade const> batch;
+        for(;;) {
+            if(!reader->next(batch, ec))
+                return false;
+            if(batch.empty())
+                break;
+            for(auto const& each: batch)
+                builder.push(each);
+            if(write_ec)
+                return detail::failed(ec, write_ec);
+        }
+        builder.flush();
+        if(write_ec)
+            return detail::failed(ec, write_ec);
+        return writer.flush_to(file.get(), ec);
+    }
+
 }
 
 
@@ -1,9 +1,23 @@
 #include <swollencandle/swollencandle.hpp>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
 
+namespace {
+
+    // Minute candle, equal to any other one of the same time
+    swollencandle::candle candle_at(std::uint64_t time) {
+        return {time, 60, 1, 1., 2., 2., 2., 2., 2.};
+    }
+
+}
+
+
 TEST_SUITE("swollencandle") {
 
     TEST_CASE("parse_upscale_period") {
@@ -19,11 +33,1061 @@ TEST_SUITE("swollencandle") {
         auto const maybe_year = swollencandle::parse_upscale_period("year");
         REQUIRE(maybe_year);
         REQUIRE_EQ(*maybe_year, swollencandle::upscale_period::year);
+        // Stored values of the original periods are kept
+        REQUIRE_EQ(int(swollencandle::upscale_period::month), 3);
+        REQUIRE_EQ(int(swollencandle::upscale_period::year), 4);
+        REQUIRE_EQ(int(swollencandle::upscale_period::week), 5);
         auto const empty = swollencandle::parse_upscale_period("");
         REQUIRE(!empty);
         auto const unknown = swollencandle::parse_upscale_period("unknown");
         REQUIRE(!unknown);
     }
 
-}
 
+    TEST_CASE("upscale candles with gaps") {
+        std::vector<swollencandle::candle> source {
+            {60, 60, 1, 1., 10., 10., 11., 9., 10.},
+            {120, 60, 2, 3., 20., 20., 21., 19., 20.},
+            {3600 + 600, 60, 1, 2., 30., 30., 31., 29., 30.},
+            {3600 + 1200, 60, 1, 2., 40., 40., 41., 39., 40.}
+        };
+        std::vector<swollencandle::candle> result;
+        bool partial_tail;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(source, result, swollencandle::upscale_period::hour,
+                                       partial_tail, ec));
+        REQUIRE_EQ(result.size(), 2);
+        REQUIRE(partial_tail);
+        REQUIRE_EQ(result[0].time, 0);
+        REQUIRE_EQ(result[0].count, 3);
+        REQUIRE_EQ(result[0].volume, 4.);
+        REQUIRE_EQ(result[0].vwap_price, 17.5);
+        REQUIRE_EQ(result[0].open_price, 10.);
+        REQUIRE_EQ(result[0].high_price, 21.);
+        REQUIRE_EQ(result[0].low_price, 9.);
+        REQUIRE_EQ(result[0].close_price, 20.);
+        REQUIRE_EQ(result[1].time, 3600);
+        REQUIRE_EQ(result[1].vwap_price, 35.);
+        REQUIRE_EQ(result[1].close_price, 40.);
+    }
+
+
+    TEST_CASE("upscale candles with vector kernel") {
+        std::vector<swollencandle::candle> source;
+        for(std::uint64_t i = 0; i != 24 * 60 + 7; ++i) {
+            auto const price = double(100 + (i * 37) % 101);
+            source.push_back({i * 60, 60, i % 5 + 1, double(i % 7 + 1),
+                              price, price, price + double(i % 3), price - double(i % 4), price});
+        }
+        // Rows of candle arrays and columns of candle series share the kernels
+        auto const check_kernels = []<std::size_t Stride>(
+                swollencandle::detail::candle_fields<Stride> const& fields,
+                std::size_t size, double tolerance) {
+            using kernel = swollencandle::detail::reduce_kernel<Stride>;
+            std::vector<kernel> kernels {&swollencandle::detail::reduce<Stride>};
+#ifdef SWOLLENCANDLE_X86_KERNELS
+            if(__builtin_cpu_supports("avx2"))
+                kernels.push_back(&swollencandle::detail::reduce_avx2<Stride>);
+            if(__builtin_cpu_supports("avx512f"))
+                kernels.push_back(&swollencandle::detail::reduce_avx512<Stride>);
+#endif
+            auto const scalar = swollencandle::detail::reduce_scalar(fields, 0, size);
+            for(auto const each: kernels) {
+                auto const totals = each(fields, 0, size);
+                REQUIRE_EQ(totals.count, scalar.count);
+                REQUIRE_LE(std::abs(totals.volume - scalar.volume), tolerance * scalar.volume);
+                REQUIRE_LE(std::abs(totals.turnover - scalar.turnover), tolerance * scalar.turnover);
+                REQUIRE_EQ(totals.high_price, scalar.high_price);
+                REQUIRE_EQ(totals.low_price, scalar.low_price);
+            }
+        };
+        auto const columns_of = [](swollencandle::candle_series const& series) {
+            return swollencandle::detail::candle_columns {
+                series.count().data(),
+                series.volume().data(),
+                series.vwap_price().data(),
+                series.high_price().data(),
+                series.low_price().data()
+            };
+        };
+
+        // Integer valued sums are exact in any order
+        swollencandle::candle_series const series{source};
+        check_kernels(swollencandle::detail::rows_of(source.data()), source.size(), 0.);
+        check_kernels(columns_of(series), series.size(), 0.);
+
+        // Vector kernels sum lane by lane, so sums are equal up to rounding only
+        std::vector<swollencandle::candle> fractional;
+        for(std::uint64_t i = 0; i != 1000; ++i) {
+            auto const price = 100. + 0.37 * double((i * 37) % 101) / 3.;
+            fractional.push_back({i * 60, 60, i % 5 + 1, 0.1 * double(i % 7 + 1) / 3.,
+                                  price, price, price + 0.01, price - 0.01, price});
+        }
+        swollencandle::candle_series const fractional_series{fractional};
+        auto constexpr tolerance = 1e-12;
+        for(std::size_t size: {8, 9, 63, 64, 1000}) {
+            check_kernels(swollencandle::detail::rows_of(fractional.data()), size, tolerance);
+            check_kernels(columns_of(fractional_series), size, tolerance);
+        }
+
+        std::vector<swollencandle::candle> result;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(source, result, swollencandle::upscale_period::day, ec));
+        REQUIRE_EQ(result.size(), 2);
+        REQUIRE_EQ(result[0].open_price, source[0].open_price);
+        REQUIRE_EQ(result[0].close_price, source[24 * 60 - 1].close_price);
+        REQUIRE_EQ(result[1].time, 86400);
+    }
+
+
+    TEST_CASE("candle_series") {
+        std::vector<swollencandle::candle> source;
+        for(std::uint64_t i = 0; i != 3 * 60 + 11; ++i) {
+            auto const price = double(100 + (i * 13) % 29);
+            source.push_back({7200 + i * 60, 60, i % 3 + 1, double(i % 5 + 1),
+                              price, price, price + 1., price - 1., price});
+        }
+        swollencandle::candle_series const series{source};
+        REQUIRE_EQ(series.size(), source.size());
+        REQUIRE_EQ(series.to_vector(), source);
+        REQUIRE_EQ(reinterpret_cast<std::uintptr_t>(series.volume().data()) % 64, 0);
+
+        std::vector<swollencandle::candle> expected;
+        swollencandle::candle_series result;
+        bool expected_tail, partial_tail;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(source, expected, swollencandle::upscale_period::hour,
+                                       expected_tail, ec));
+        REQUIRE(swollencandle::upscale(series, result, swollencandle::upscale_period::hour,
+                                       partial_tail, ec));
+        REQUIRE_EQ(result.to_vector(), expected);
+        REQUIRE_EQ(partial_tail, expected_tail);
+
+        swollencandle::candle_series const head{std::vector<swollencandle::candle>(
+            source.begin(), source.begin() + 100)};
+        swollencandle::candle_series merged;
+        REQUIRE(swollencandle::merge(head, series, merged, ec));
+        REQUIRE_EQ(merged.to_vector(), source);
+        auto changed = source;
+        changed[50].close_price += 1.;
+        REQUIRE_FALSE(swollencandle::merge(head, swollencandle::candle_series{changed}, merged, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_candles));
+        REQUIRE_EQ(merged.to_vector(), source);
+
+        // Unsorted rows are merged through stable sort with the checks of vectors
+        std::vector<swollencandle::candle> reversed{source.rbegin(), source.rend()};
+        REQUIRE(swollencandle::merge(swollencandle::candle_series{reversed}, head, merged, ec));
+        REQUIRE_EQ(merged.to_vector(), source);
+        reversed.push_back(source[7]);
+        REQUIRE_FALSE(swollencandle::merge(swollencandle::candle_series{reversed}, head, merged, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::duplicated_candle));
+        std::vector<swollencandle::candle> unused;
+        REQUIRE_FALSE(swollencandle::merge(reversed, source, unused, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::duplicated_candle));
+        REQUIRE_EQ(merged.to_vector(), source);
+    }
+
+
+    TEST_CASE("upscale_cascade") {
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 5000; ++i)
+            trades.push_back({1000 + i * 37 + i % 11, double(i % 9 + 1), double(50 + (i * 7) % 23)});
+        using swollencandle::upscale_period;
+        std::vector<upscale_period> const periods {
+            upscale_period::minute, upscale_period::hour, upscale_period::day
+        };
+        std::vector<std::vector<swollencandle::candle>> results;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale_cascade(trades, periods, results, ec));
+        REQUIRE_EQ(results.size(), periods.size());
+        for(std::size_t i = 0; i != periods.size(); ++i) {
+            std::vector<swollencandle::candle> expected;
+            REQUIRE(swollencandle::upscale(trades, expected, periods[i], ec));
+            REQUIRE_EQ(results[i], expected);
+        }
+
+        // Coarser periods sum rounded minute turnover, fractional input differs in last bits
+        std::vector<swollencandle::trade> fractional;
+        for(std::uint64_t i = 0; i != 5000; ++i)
+            fractional.push_back({1000 + i * 37, 0.1 * double(i % 9 + 1), 50.37 + 0.013 * double(i % 23)});
+        REQUIRE(swollencandle::upscale_cascade(fractional, periods, results, ec));
+        for(std::size_t i = 0; i != periods.size(); ++i) {
+            std::vector<swollencandle::candle> expected;
+            REQUIRE(swollencandle::upscale(fractional, expected, periods[i], ec));
+            REQUIRE_EQ(results[i].size(), expected.size());
+            for(std::size_t j = 0; j != expected.size(); ++j) {
+                auto const& x = results[i][j];
+                auto const& y = expected[j];
+                REQUIRE_EQ(x.time, y.time);
+                REQUIRE_EQ(x.count, y.count);
+                REQUIRE_EQ(x.open_price, y.open_price);
+                REQUIRE_EQ(x.high_price, y.high_price);
+                REQUIRE_EQ(x.low_price, y.low_price);
+                REQUIRE_EQ(x.close_price, y.close_price);
+                REQUIRE_LE(std::abs(x.volume - y.volume), 1e-12 * y.volume);
+                REQUIRE_LE(std::abs(x.vwap_price - y.vwap_price), 1e-12 * y.vwap_price);
+            }
+        }
+
+        auto const before = results;
+        std::vector<upscale_period> const unnested {upscale_period::hour, upscale_period::minute};
+        REQUIRE(!swollencandle::upscale_cascade(trades, unnested, results, ec));
+        REQUIRE_EQ(ec, swollencandle::error::invalid_upscale_period);
+        REQUIRE_EQ(results, before);
+
+        ec.clear();
+        REQUIRE(!swollencandle::upscale_cascade(trades, std::span<upscale_period const>{}, results, ec));
+        REQUIRE_EQ(ec, swollencandle::error::invalid_upscale_period);
+        REQUIRE_EQ(results, before);
+    }
+
+
+    TEST_CASE("candle_builder") {
+        std::vector<swollencandle::trade> const trades {
+            {10, 1., 100.}, {30, 2., 103.}, {59, 1., 99.},
+            {60, 3., 101.},
+            {130, 1., 102.}, {150, 1., 104.}
+        };
+        std::vector<swollencandle::candle> const expected {
+            {0, 60, 3, 4., 101.25, 100., 103., 99., 99.},
+            {60, 60, 1, 3., 101., 101., 101., 101., 101.},
+            {120, 60, 2, 2., 103., 102., 104., 102., 104.}
+        };
+
+        std::vector<swollencandle::candle> closed;
+        swollencandle::candle_builder builder{swollencandle::upscale_period::minute,
+            [&closed](swollencandle::candle const& each) { closed.push_back(each); }};
+        for(auto const& each: trades)
+            builder.push(each);
+        REQUIRE(builder.has_open_candle());
+        REQUIRE_EQ(closed.size(), expected.size() - 1);
+        builder.flush();
+        REQUIRE(!builder.has_open_candle());
+        REQUIRE_EQ(closed, expected);
+
+        std::vector<swollencandle::candle> upscaled;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(trades, upscaled, swollencandle::upscale_period::minute, ec));
+        REQUIRE_EQ(upscaled, expected);
+    }
+
+
+    TEST_CASE("upscale_parallel") {
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 300000; ++i)
+            trades.push_back({i / 3, 0.1 * double(i % 7 + 1), 100. + 0.01 * double(i % 17)});
+        std::vector<swollencandle::candle> expected, result;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(trades, expected, swollencandle::upscale_period::hour, ec));
+        REQUIRE(swollencandle::upscale_parallel(trades, result, swollencandle::upscale_period::hour,
+                                                4, ec));
+        REQUIRE_EQ(result, expected);
+        REQUIRE(swollencandle::upscale_parallel(trades, result, swollencandle::upscale_period::minute,
+                                                ec));
+        REQUIRE(swollencandle::upscale(trades, expected, swollencandle::upscale_period::minute, ec));
+        REQUIRE_EQ(result, expected);
+        REQUIRE(swollencandle::upscale_parallel(trades, result, swollencandle::upscale_period::minute,
+                                                0, ec));
+        REQUIRE_EQ(result, expected);
+    }
+
+
+    TEST_CASE("execution policies") {
+        std::vector<swollencandle::candle> source;
+        for(std::uint64_t i = 0; i != 100000; ++i) {
+            auto const price = double(100 + (i * 13) % 29);
+            source.push_back({i * 60, 60, 1, double(i % 5 + 1), price, price, price + 1., price - 1., price});
+        }
+        std::vector<swollencandle::candle> expected, result;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(source, expected, swollencandle::upscale_period::hour, ec));
+        REQUIRE(swollencandle::upscale(swollencandle::execution::par_unseq, source, result,
+                                       swollencandle::upscale_period::hour, ec));
+        REQUIRE_EQ(result, expected);
+        REQUIRE(swollencandle::upscale(swollencandle::execution::seq, source, result,
+                                       swollencandle::upscale_period::hour, ec));
+        REQUIRE_EQ(result, expected);
+
+        std::vector<swollencandle::candle> const tail(source.begin() + 50000, source.end());
+        REQUIRE(swollencandle::merge(swollencandle::execution::par, tail, source, result, ec));
+        REQUIRE_EQ(result, source);
+    }
+
+
+    TEST_CASE("upscale with constant period") {
+        using swollencandle::upscale_period;
+        // Friday, 1 January 2021, trades span 19 hours and 26 minutes
+        auto constexpr base = std::uint64_t(1609459200);
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 10000; ++i)
+            trades.push_back({base + i * 7, 0.5 * double(i % 3 + 1), 10. + 0.25 * double(i % 13)});
+        std::vector<swollencandle::candle> expected, result;
+        std::error_code ec;
+
+        REQUIRE(swollencandle::upscale<upscale_period::minute>(trades, result, ec));
+        REQUIRE_EQ(result.size(), 1167);
+        REQUIRE_EQ(result[0].time, base);
+        REQUIRE_EQ(result[0].count, 9);
+        REQUIRE_EQ(result[1166].time, base + 69960);
+        REQUIRE_EQ(result[1166].count, 5);
+
+        REQUIRE(swollencandle::upscale<upscale_period::hour>(trades, result, ec));
+        REQUIRE_EQ(result.size(), 20);
+        REQUIRE_EQ(result[0].count, 515);
+        REQUIRE_EQ(result[19].time, base + 19 * 3600);
+        REQUIRE_EQ(result[19].count, 228);
+        REQUIRE(swollencandle::upscale(trades, expected, upscale_period::hour, ec));
+        REQUIRE_EQ(result, expected);
+
+        // The whole range falls into one bucket of longer periods
+        auto const whole = [&](std::uint64_t time, std::uint32_t period) {
+            REQUIRE_EQ(result.size(), 1);
+            REQUIRE_EQ(result[0].time, time);
+            REQUIRE_EQ(result[0].period, period);
+            REQUIRE_EQ(result[0].count, 10000);
+            REQUIRE_EQ(result[0].volume, 9999.5);
+            REQUIRE_EQ(result[0].open_price, 10.);
+            REQUIRE_EQ(result[0].high_price, 13.);
+            REQUIRE_EQ(result[0].low_price, 10.);
+            REQUIRE_EQ(result[0].close_price, 10.5);
+        };
+        REQUIRE(swollencandle::upscale<upscale_period::day>(trades, result, ec));
+        whole(base, 86400);
+        REQUIRE(swollencandle::upscale<upscale_period::week>(trades, result, ec));
+        whole(base - 4 * 86400, 604800);
+        REQUIRE(swollencandle::upscale<upscale_period::month>(trades, result, ec));
+        whole(base, 2592000);
+        REQUIRE(swollencandle::upscale<upscale_period::year>(trades, result, ec));
+        whole(base, 31104000);
+
+        std::vector<swollencandle::candle> hours = expected;
+        REQUIRE(swollencandle::upscale<upscale_period::day>(hours, result, ec));
+        whole(base, 86400);
+
+        REQUIRE(!swollencandle::upscale(trades, result, swollencandle::upscale_period(42), ec));
+        REQUIRE_EQ(ec, swollencandle::error::invalid_upscale_period);
+    }
+
+
+    TEST_CASE("timeframes") {
+        using swollencandle::upscale_period;
+        auto const quarter_hour = swollencandle::parse_timeframe("15m");
+        REQUIRE(quarter_hour);
+        REQUIRE_EQ(*quarter_hour, swollencandle::timeframe{upscale_period::minute, 15});
+        REQUIRE_EQ(*swollencandle::parse_timeframe("4h"), swollencandle::timeframe{upscale_period::hour, 4});
+        REQUIRE_EQ(*swollencandle::parse_timeframe("1w"), swollencandle::timeframe{upscale_period::week});
+        REQUIRE_EQ(*swollencandle::parse_timeframe("3M"), swollencandle::timeframe{upscale_period::month, 3});
+        REQUIRE_EQ(*swollencandle::parse_timeframe("day"), swollencandle::timeframe{upscale_period::day});
+        REQUIRE(!swollencandle::parse_timeframe("0m"));
+        REQUIRE(!swollencandle::parse_timeframe("15"));
+        REQUIRE(!swollencandle::parse_timeframe("15q"));
+        REQUIRE(!swollencandle::parse_timeframe("1000y"));
+        REQUIRE_EQ(*swollencandle::parse_upscale_period("week"), upscale_period::week);
+
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 20000; ++i)
+            trades.push_back({86400 * 10 + i * 29, double(i % 3 + 1), double(20 + i % 11)});
+        std::vector<swollencandle::candle> minutes, from_trades, from_minutes;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(trades, minutes, upscale_period::minute, ec));
+        REQUIRE(swollencandle::upscale(trades, from_trades, *quarter_hour, ec));
+        REQUIRE(swollencandle::upscale(minutes, from_minutes, *quarter_hour, ec));
+        REQUIRE_EQ(from_trades.front().period, 900);
+        REQUIRE_EQ(from_trades, from_minutes);
+
+        std::vector<swollencandle::candle> weeks;
+        REQUIRE(swollencandle::upscale(trades, weeks, upscale_period::week, ec));
+        REQUIRE_EQ(weeks.front().time, 86400 * 4);   // Monday, 5 January 1970
+        REQUIRE_EQ(weeks[1].time, 86400 * 11);
+
+        // Times before the first Monday fall into the week from 0
+        std::vector<swollencandle::trade> const early{
+            {100, 1, 1}, {86400 * 3, 1, 1}, {86400 * 4 + 5, 1, 1}, {86400 * 12, 1, 1}};
+        REQUIRE(swollencandle::upscale(early, weeks, upscale_period::week, ec));
+        REQUIRE_EQ(weeks.size(), 3);
+        REQUIRE_EQ(weeks[0].time, 0);
+        REQUIRE_EQ(weeks[0].count, 2);
+        REQUIRE_EQ(weeks[1].time, 86400 * 4);
+        REQUIRE_EQ(weeks[2].time, 86400 * 11);
+        std::vector<swollencandle::candle> constant_weeks;
+        REQUIRE(swollencandle::upscale<upscale_period::week>(early, constant_weeks, ec));
+        REQUIRE_EQ(constant_weeks, weeks);
+        REQUIRE(swollencandle::upscale(early, weeks, swollencandle::timeframe{upscale_period::week, 2}, ec));
+        REQUIRE_EQ(weeks.size(), 2);
+        REQUIRE_EQ(weeks[0].time, 0);
+        REQUIRE_EQ(weeks[0].count, 2);
+        REQUIRE_EQ(weeks[1].time, 86400 * 4);
+        REQUIRE_EQ(weeks[1].count, 2);
+
+        std::vector<swollencandle::candle> days;
+        REQUIRE(swollencandle::upscale(early, days, upscale_period::day, ec));
+        REQUIRE(swollencandle::upscale(days, weeks, upscale_period::week, ec));
+        REQUIRE_EQ(weeks, constant_weeks);
+    }
+
+
+    TEST_CASE("calendar months and years") {
+        using swollencandle::upscale_period;
+        auto constexpr jan_2020 = std::uint64_t(1577836800);
+        auto constexpr feb_2020 = std::uint64_t(1580515200);
+        auto constexpr mar_2020 = std::uint64_t(1583020800);
+        auto constexpr jan_2021 = std::uint64_t(1609459200);
+        std::vector<swollencandle::candle> days;
+        for(auto time = jan_2020; time != jan_2021 + 40 * 86400; time += 86400)
+            days.push_back({time, 86400, 1, 1., 10., 10., 11., 9., 10.});
+        std::vector<swollencandle::candle> months, years;
+        std::error_code ec;
+        REQUIRE(swollencandle::upscale(days, months, upscale_period::month, ec));
+        REQUIRE_EQ(months.size(), 14);
+        REQUIRE_EQ(months[0].time, jan_2020);
+        REQUIRE_EQ(months[0].count, 31);
+        REQUIRE_EQ(months[1].time, feb_2020);
+        REQUIRE_EQ(months[1].count, 29);
+        REQUIRE_EQ(months[2].time, mar_2020);
+        REQUIRE_EQ(months[12].time, jan_2021);
+        REQUIRE_EQ(months[0].period, swollencandle::seconds_in(upscale_period::month));
+
+        REQUIRE(swollencandle::upscale(months, years, upscale_period::year, ec));
+        REQUIRE_EQ(years.size(), 2);
+        REQUIRE_EQ(years[0].time, jan_2020);
+        REQUIRE_EQ(years[0].count, 366);
+        REQUIRE_EQ(years[1].time, jan_2021);
+
+        std::vector<swollencandle::candle> quarters;
+        REQUIRE(swollencandle::upscale(days, quarters,
+                                       swollencandle::timeframe{upscale_period::month, 3}, ec));
+        REQUIRE_EQ(quarters[0].count, 31 + 29 + 31);
+
+        std::vector<swollencandle::trade> trades;
+        for(auto const& each: days)
+            trades.push_back({each.time + 3600, 1., 10.});
+        std::vector<swollencandle::candle> built;
+        swollencandle::candle_builder builder{upscale_period::month,
+            [&built](swollencandle::candle const& each) { built.push_back(each); }};
+        for(auto const& each: trades)
+            builder.push(each);
+        builder.flush();
+        REQUIRE_EQ(built.size(), months.size());
+        for(std::size_t i = 0; i != built.size(); ++i) {
+            REQUIRE_EQ(built[i].time, months[i].time);
+            REQUIRE_EQ(built[i].count, months[i].count);
+        }
+
+        std::vector<swollencandle::candle> weeks;
+        REQUIRE(swollencandle::upscale(days, weeks, upscale_period::week, ec));
+        REQUIRE(!swollencandle::upscale(weeks, months, upscale_period::month, ec));
+
+        // A year of month candles is complete although months are longer than nominal
+        std::vector<swollencandle::trade> year_trades;
+        for(auto time = jan_2021; time != jan_2021 + 365 * 86400; time += 86400)
+            year_trades.push_back({time + 3600, 1., 10.});
+        REQUIRE(swollencandle::upscale(year_trades, months, upscale_period::month, ec));
+        REQUIRE_EQ(months.size(), 12);
+        bool partial_tail;
+        REQUIRE(swollencandle::upscale(months, years, upscale_period::year, partial_tail, ec));
+        REQUIRE_EQ(years.size(), 1);
+        REQUIRE_EQ(years[0].count, 365);
+        REQUIRE_FALSE(partial_tail);
+        swollencandle::candle_series series_years;
+        REQUIRE(swollencandle::upscale(swollencandle::candle_series{months}, series_years,
+                                       upscale_period::year, partial_tail, ec));
+        REQUIRE_FALSE(partial_tail);
+        months.pop_back();
+        REQUIRE(swollencandle::upscale(months, years, upscale_period::year, partial_tail, ec));
+        REQUIRE(partial_tail);
+    }
+
+
+    TEST_CASE("session aligned buckets") {
+        using swollencandle::upscale_period;
+        auto constexpr day = std::uint64_t(86400);
+        auto constexpr hour = std::uint64_t(3600);
+        std::vector<swollencandle::trade> trades;
+        for(auto time = 10 * day; time != 14 * day; time += hour)
+            trades.push_back({time, 1., 10.});
+        std::vector<swollencandle::candle> days;
+        std::error_code ec;
+        swollencandle::session const moscow{3 * 3600};
+        REQUIRE(swollencandle::upscale(trades, days, upscale_period::day, moscow, ec));
+        REQUIRE_EQ(days.size(), 5);
+        REQUIRE_EQ(days[0].time, 10 * day - 3 * hour);
+        REQUIRE_EQ(days[0].count, 21);
+        REQUIRE_EQ(days[1].time, 11 * day - 3 * hour);
+        REQUIRE_EQ(days[1].count, 24);
+
+        // Clocks move forward at 01:00 UTC of day 12, from +1 to +2
+        swollencandle::session const summer{3600, {{12 * day + hour, 7200}}};
+        std::vector<swollencandle::candle> hours;
+        REQUIRE(swollencandle::upscale(trades, hours, upscale_period::hour, ec));
+        REQUIRE(swollencandle::upscale(hours, days, upscale_period::day, summer, ec));
+        REQUIRE_EQ(days[1].time, 11 * day - hour);
+        REQUIRE_EQ(days[1].count, 24);
+        REQUIRE_EQ(days[2].time, 12 * day - hour);
+        REQUIRE_EQ(days[2].count, 23);
+        REQUIRE_EQ(days[3].time, 13 * day - 2 * hour);
+        REQUIRE_EQ(days[3].count, 24);
+
+        swollencandle::session const india{5 * 3600 + 1800};
+        REQUIRE(!swollencandle::upscale(hours, days, upscale_period::day, india, ec));
+    }
+
+
+    TEST_CASE("nanosecond timestamps") {
+        using swollencandle::upscale_period;
+        auto constexpr ns = std::uint64_t(1000000000);
+        std::vector<swollencandle::trade> trades, nano_trades;
+        for(std::uint64_t i = 0; i != 20000; ++i) {
+            trades.push_back({1600000000 + i * 17, double(i % 3 + 1), double(20 + i % 11)});
+            nano_trades.push_back({trades.back().time * ns + i % 1000, trades.back().amount,
+                                   trades.back().price});
+        }
+        std::error_code ec;
+        for(auto const tf: {swollencandle::timeframe{upscale_period::minute, 15},
+                            swollencandle::timeframe{upscale_period::day},
+                            swollencandle::timeframe{upscale_period::month}}) {
+            std::vector<swollencandle::candle> expected, result;
+            REQUIRE(swollencandle::upscale(trades, expected, tf, ec));
+            REQUIRE(swollencandle::upscale<std::chrono::nanoseconds>(nano_trades, result, tf, ec));
+            REQUIRE_EQ(result.size(), expected.size());
+            for(auto& each: expected)
+                each.time *= ns;
+            REQUIRE_EQ(result, expected);
+        }
+
+        std::vector<swollencandle::candle> minutes, hours, expected;
+        REQUIRE(swollencandle::upscale<std::chrono::nanoseconds>(nano_trades, minutes,
+                                                                 upscale_period::minute, ec));
+        bool partial_tail;
+        REQUIRE(swollencandle::upscale<std::chrono::nanoseconds>(minutes, hours, upscale_period::hour,
+                                                                 partial_tail, ec));
+        REQUIRE(swollencandle::upscale(trades, expected, upscale_period::hour, ec));
+        REQUIRE_EQ(hours.size(), expected.size());
+        REQUIRE_EQ(hours.back().time, expected.back().time * ns);
+        REQUIRE_EQ(hours.back().count, expected.back().count);
+
+        std::vector<swollencandle::candle> built;
+        auto builder = swollencandle::make_candle_builder<std::chrono::nanoseconds>(
+            upscale_period::hour, [&built](swollencandle::candle const& each) { built.push_back(each); });
+        for(auto const& each: nano_trades)
+            builder.push(each);
+        builder.flush();
+        REQUIRE_EQ(built.size(), expected.size());
+        REQUIRE_EQ(built.front().time, expected.front().time * ns);
+    }
+
+
+    TEST_CASE("caller provided output") {
+        using swollencandle::upscale_period;
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 5000; ++i)
+            trades.push_back({1600000000 + i * 7, double(i % 5 + 1), double(30 + i % 13)});
+        std::error_code ec;
+        swollencandle::timeframe const tf{upscale_period::minute, 5};
+        std::vector<swollencandle::candle> expected;
+        REQUIRE(swollencandle::upscale(trades, expected, tf, ec));
+
+        auto const estimate = swollencandle::estimate_candle_count(trades, tf);
+        REQUIRE_GE(estimate, expected.size());
+        REQUIRE_LE(estimate, expected.size() + 2);
+        REQUIRE_GE(swollencandle::estimate_candle_count(trades, upscale_period::month), 1);
+
+        std::vector<swollencandle::candle> arena(estimate);
+        std::size_t written;
+        REQUIRE(swollencandle::upscale(trades, std::span{arena}, written, tf, ec));
+        REQUIRE_EQ(written, expected.size());
+        REQUIRE(std::equal(expected.begin(), expected.end(), arena.begin()));
+
+        std::vector<swollencandle::candle> hours;
+        REQUIRE(swollencandle::upscale(expected, hours, upscale_period::hour, ec));
+        bool partial_tail;
+        REQUIRE(swollencandle::upscale(expected, std::span{arena}, written, upscale_period::hour,
+                                       partial_tail, ec));
+        REQUIRE_EQ(written, hours.size());
+        REQUIRE(std::equal(hours.begin(), hours.end(), arena.begin()));
+
+        REQUIRE_FALSE(swollencandle::upscale(trades, std::span{arena}.first(3), written, tf, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::insufficient_buffer));
+        REQUIRE_EQ(written, expected.size());
+
+        // Capacity is kept between calls
+        auto const capacity = expected.capacity();
+        REQUIRE(swollencandle::upscale(trades, expected, tf, ec));
+        REQUIRE_EQ(expected.capacity(), capacity);
+    }
+
+
+    TEST_CASE("memory resources") {
+        using swollencandle::upscale_period;
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 3000; ++i)
+            trades.push_back({1600000000 + i * 11, double(i % 4 + 1), double(50 + i % 9)});
+        std::error_code ec;
+        std::vector<swollencandle::candle> expected;
+        REQUIRE(swollencandle::upscale(trades, expected, upscale_period::minute, ec));
+        std::vector<swollencandle::candle> const first_half(expected.begin(),
+                                                            expected.begin() + expected.size() / 2);
+
+        std::vector<std::byte> buffer(std::size_t(1) << 20);
+        std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size(),
+                                                  std::pmr::null_memory_resource()};
+        // Nothing should come from global heap
+        auto const previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+
+        std::pmr::vector<swollencandle::candle> candles{&arena};
+        auto const upscaled = swollencandle::upscale(trades, candles, upscale_period::minute, ec);
+        std::pmr::vector<swollencandle::candle> merged{&arena};
+        auto const merged_ok = swollencandle::merge(first_half, expected, merged, ec);
+        swollencandle::candle_series series{&arena};
+        series.assign(expected);
+        auto const series_in_arena = series.resource() == &arena;
+
+        std::pmr::set_default_resource(previous);
+
+        REQUIRE(upscaled);
+        REQUIRE(std::equal(candles.begin(), candles.end(), expected.begin(), expected.end()));
+        REQUIRE(merged_ok);
+        REQUIRE(std::equal(merged.begin(), merged.end(), expected.begin(), expected.end()));
+        REQUIRE(series_in_arena);
+        REQUIRE_EQ(series.to_vector(), expected);
+        swollencandle::candle_series const copy = series;
+        REQUIRE_NE(copy.resource(), &arena);
+    }
+
+
+    TEST_CASE("contiguous ranges") {
+        using swollencandle::upscale_period;
+        std::array<swollencandle::trade, 6> const trades {{
+            {60, 1., 10.}, {70, 2., 12.}, {130, 1., 11.}, {190, 3., 9.}, {200, 1., 10.}, {250, 1., 8.}
+        }};
+        std::error_code ec;
+        std::vector<swollencandle::candle> minutes;
+        REQUIRE(swollencandle::upscale(trades, minutes, upscale_period::minute, ec));
+        REQUIRE_EQ(minutes.size(), 4);
+
+        // Tail of buffer without copying
+        std::vector<swollencandle::candle> tail;
+        REQUIRE(swollencandle::upscale(std::span{trades}.subspan(2), tail, upscale_period::minute, ec));
+        REQUIRE_EQ(tail.size(), 3);
+        REQUIRE(std::equal(tail.begin(), tail.end(), minutes.begin() + 1));
+
+        std::vector<swollencandle::candle> merged;
+        std::span<swollencandle::candle const> const view{minutes};
+        REQUIRE(swollencandle::merge(view.first(2), view.subspan(1), merged, ec));
+        REQUIRE_EQ(merged, minutes);
+
+        swollencandle::candle_series const series{view.last(2)};
+        REQUIRE_EQ(series.size(), 2);
+        REQUIRE_EQ(series[0], minutes[2]);
+    }
+
+
+    TEST_CASE("sorted merge") {
+        std::vector<swollencandle::candle> x, y, expected;
+        for(std::uint64_t i = 0; i != 1000; ++i) {
+            auto const time = i * 60;
+            if(i % 3 != 0)
+                x.push_back(candle_at(time));
+            if(i % 2 == 0)
+                y.push_back(candle_at(time));
+            if(i % 3 != 0 || i % 2 == 0)
+                expected.push_back(candle_at(time));
+        }
+        y.insert(y.begin() + 10, y[10]);
+
+        std::error_code ec;
+        std::vector<swollencandle::candle> z;
+        REQUIRE(swollencandle::merge(x, y, z, ec));
+        REQUIRE_EQ(z, expected);
+
+        // Unsorted input takes the indexed path with the same result
+        std::vector<swollencandle::candle> shuffled{y.rbegin(), y.rend()};
+        REQUIRE(swollencandle::merge(x, shuffled, z, ec));
+        REQUIRE_EQ(z, expected);
+
+        // Output is left unchanged on error
+        auto mismatched = y;
+        mismatched[20].volume = 2.;
+        REQUIRE_FALSE(swollencandle::merge(x, mismatched, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_candles));
+        REQUIRE_EQ(z, expected);
+
+        auto duplicated = x;
+        duplicated.insert(duplicated.begin() + 5, duplicated[5]);
+        REQUIRE_FALSE(swollencandle::merge(duplicated, mismatched, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::duplicated_candle));
+    }
+
+
+    TEST_CASE("merge of several sources") {
+        std::vector<std::vector<swollencandle::candle>> sources(5);
+        for(std::uint64_t i = 0; i != 2000; ++i)
+            for(std::size_t s = 0; s != sources.size(); ++s)
+                if((i * 7 + s * 3) % (s + 2) == 0)
+                    sources[s].push_back(candle_at(i * 60));
+
+        std::error_code ec;
+        std::vector<swollencandle::candle> expected, step;
+        REQUIRE(swollencandle::merge(sources[0], sources[1], expected, ec));
+        for(std::size_t s = 2; s != sources.size(); ++s) {
+            REQUIRE(swollencandle::merge(expected, sources[s], step, ec));
+            expected.swap(step);
+        }
+
+        std::vector<swollencandle::candle> z;
+        REQUIRE(swollencandle::merge(sources, z, ec));
+        REQUIRE_EQ(z, expected);
+
+        // Unsorted source falls back to pairwise merges
+        auto unsorted = sources;
+        std::reverse(unsorted[3].begin(), unsorted[3].end());
+        REQUIRE(swollencandle::merge(unsorted, z, ec));
+        REQUIRE_EQ(z, expected);
+
+        // Output is left unchanged on error
+        auto mismatched = sources;
+        mismatched[4][7].close_price = 3.;
+        REQUIRE_FALSE(swollencandle::merge(mismatched, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_candles));
+        REQUIRE_EQ(z, expected);
+        std::reverse(mismatched[3].begin(), mismatched[3].end());
+        REQUIRE_FALSE(swollencandle::merge(mismatched, z, ec));
+        REQUIRE_EQ(z, expected);
+
+        auto duplicated = sources;
+        duplicated[0].push_back(duplicated[0].back());
+        REQUIRE_FALSE(swollencandle::merge(duplicated, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::duplicated_candle));
+
+        // Duplicates of later sources are fine while they agree
+        auto repeated = sources;
+        repeated[2].push_back(repeated[2].back());
+        REQUIRE(swollencandle::merge(repeated, z, ec));
+        REQUIRE_EQ(z, expected);
+    }
+
+
+    TEST_CASE("append_merge") {
+        std::vector<swollencandle::candle> history;
+        for(std::uint64_t i = 0; i != 10000; ++i)
+            if(i % 100 != 97)
+                history.push_back(candle_at(i * 60));
+        std::vector<swollencandle::candle> update;
+        for(std::uint64_t i = 9790; i != 10100; ++i)
+            update.push_back(candle_at(i * 60));
+
+        std::error_code ec;
+        std::vector<swollencandle::candle> expected;
+        REQUIRE(swollencandle::merge(history, update, expected, ec));
+
+        auto appended = history;
+        REQUIRE(swollencandle::append_merge(appended, update, ec));
+        REQUIRE_EQ(appended, expected);
+
+        // Unsorted update with repeats
+        appended = history;
+        auto shuffled = update;
+        std::reverse(shuffled.begin(), shuffled.end());
+        shuffled.push_back(update.front());
+        REQUIRE(swollencandle::append_merge(appended, shuffled, ec));
+        REQUIRE_EQ(appended, expected);
+
+        // Update before the whole history
+        std::vector<swollencandle::candle> empty;
+        REQUIRE(swollencandle::append_merge(empty, history, ec));
+        REQUIRE_EQ(empty, history);
+        std::vector<swollencandle::candle> late{candle_at(600000)};
+        REQUIRE(swollencandle::append_merge(late, history, ec));
+        REQUIRE_EQ(late.size(), history.size() + 1);
+        REQUIRE(std::is_sorted(late.begin(), late.end()));
+
+        auto mismatched = update;
+        mismatched[5].high_price = 3.;
+        appended = history;
+        REQUIRE_FALSE(swollencandle::append_merge(appended, mismatched, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_candles));
+        REQUIRE_EQ(appended, history);
+    }
+
+
+    TEST_CASE("merge of trades sharing time") {
+        using swollencandle::trade;
+        std::error_code ec;
+        std::vector<trade> z;
+
+        // Without sequence numbers trades of the same second are matched by order
+        std::vector<trade> const x {{10, 1., 5.}, {10, 2., 6.}, {11, 1., 5.}};
+        std::vector<trade> const y {{10, 1., 5.}, {10, 2., 6.}, {10, 3., 7.}, {12, 1., 4.}};
+        REQUIRE(swollencandle::merge(x, y, z, ec));
+        REQUIRE_EQ(z, std::vector<trade>{{10, 1., 5.}, {10, 2., 6.}, {10, 3., 7.},
+                                         {11, 1., 5.}, {12, 1., 4.}});
+
+        // Output is left unchanged on error
+        std::vector<trade> const other {{10, 2., 6.}};
+        REQUIRE_FALSE(swollencandle::merge(x, other, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_trade));
+        REQUIRE_EQ(z.size(), 5);
+
+        // Sequence numbers take precedence over order, unsorted inputs are sorted
+        std::vector<trade> const sx {{10, 1., 5., 2}, {10, 2., 6., 1}, {10, 4., 6., 4}};
+        std::vector<trade> const sy {{10, 3., 7., 3}, {10, 2., 6., 1}, {10, 3., 7., 3}};
+        REQUIRE(swollencandle::merge(sx, sy, z, ec));
+        REQUIRE_EQ(z, std::vector<trade>{{10, 2., 6., 1}, {10, 1., 5., 2}, {10, 3., 7., 3},
+                                         {10, 4., 6., 4}});
+
+        std::vector<trade> const repeated {{10, 1., 5., 2}, {10, 1., 5., 2}};
+        REQUIRE_FALSE(swollencandle::merge(repeated, sy, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::duplicated_trade));
+
+        std::vector<trade> const conflicting {{10, 3., 7., 3}, {10, 3., 8., 3}};
+        REQUIRE_FALSE(swollencandle::merge(sx, conflicting, z, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_trade));
+    }
+
+
+    TEST_CASE("merge_parallel") {
+        std::vector<swollencandle::candle> x, y;
+        for(std::uint64_t i = 0; i != 300000; ++i) {
+            if(i % 5 != 0)
+                x.push_back(candle_at(i * 60));
+            if(i % 3 == 0 || i > 200000)
+                y.push_back(candle_at(i * 60));
+        }
+        std::error_code ec;
+        std::vector<swollencandle::candle> expected, z;
+        REQUIRE(swollencandle::merge(x, y, expected, ec));
+        REQUIRE(swollencandle::merge_parallel(x, y, z, 4, ec));
+        REQUIRE_EQ(z, expected);
+        REQUIRE(swollencandle::merge(swollencandle::execution::par, y, x, z, ec));
+        REQUIRE_EQ(z, expected);
+        REQUIRE(swollencandle::merge_parallel(x, y, z, 0, ec));
+        REQUIRE_EQ(z, expected);
+
+        y.back().low_price = 1.;
+        REQUIRE_FALSE(swollencandle::merge_parallel(x, y, z, 4, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::mismatched_candles));
+        REQUIRE_EQ(z, expected);
+        REQUIRE_FALSE(swollencandle::merge_parallel(x, y, z, 1, ec));
+        REQUIRE_EQ(z, expected);
+
+        // Same second trades straddling split points
+        std::vector<swollencandle::trade> tx, ty, sx, sy;
+        for(std::uint64_t i = 0; i != 400000; ++i) {
+            swollencandle::trade const each{i / 7, double(i % 7 + 1), double(i % 11 + 1)};
+            tx.push_back(each);
+            if(each.time % 3 == 0)
+                ty.push_back(each);
+            swollencandle::trade const sequenced{i / 7, double(i % 7 + 1), double(i % 11 + 1), i + 1};
+            if(i % 4 != 0)
+                sx.push_back(sequenced);
+            if(i % 4 != 1)
+                sy.push_back(sequenced);
+        }
+        std::vector<swollencandle::trade> expected_trades, trades;
+        REQUIRE(swollencandle::merge(ty, tx, expected_trades, ec));
+        REQUIRE_EQ(expected_trades, tx);
+        REQUIRE(swollencandle::merge_parallel(ty, tx, trades, 4, ec));
+        REQUIRE_EQ(trades, expected_trades);
+        REQUIRE(swollencandle::merge(sx, sy, expected_trades, ec));
+        REQUIRE_EQ(expected_trades.size(), 400000);
+        REQUIRE(swollencandle::merge_parallel(sx, sy, trades, 4, ec));
+        REQUIRE_EQ(trades, expected_trades);
+    }
+
+
+    TEST_CASE("read memory mapped files") {
+        auto const path = std::filesystem::temp_directory_path() / "swollencandle-mapped.csv";
+        // Page sized file without trailing newline, nothing is mapped past its end
+        std::string text;
+        std::vector<swollencandle::trade> expected;
+        for(std::uint64_t i = 0; text.size() < 4000; ++i) {
+            expected.push_back({1600000000 + i, 1., 10.5});
+            text += std::to_string(expected.back().time) + ",10.5,1\n";
+        }
+        text.pop_back();
+        text.resize(4096, ' ');
+        {
+            std::ofstream file{path, std::ios::binary};
+            file << text;
+        }
+        std::error_code ec;
+        std::vector<swollencandle::trade> trades;
+        REQUIRE(swollencandle::read(path.string(), trades, ec));
+        REQUIRE_EQ(trades, expected);
+
+        auto const reader = cosevalues::reader::from_file(path.string(), ec);
+        REQUIRE(reader);
+        REQUIRE_EQ(reader->text(), text);
+
+        std::vector<swollencandle::candle> candles;
+        REQUIRE(swollencandle::upscale(trades, candles, swollencandle::upscale_period::minute, ec));
+        REQUIRE(swollencandle::write(path.string(), candles, ec));
+        std::vector<swollencandle::candle> read_back;
+        REQUIRE(swollencandle::read(path.string(), read_back, ec));
+        REQUIRE_EQ(read_back.size(), candles.size());
+        REQUIRE_EQ(read_back.back().count, candles.back().count);
+        std::filesystem::remove(path);
+    }
+
+
+    TEST_CASE("fields across scanned blocks") {
+        // Every field and row boundary falls at each offset within 64 byte blocks.
+        // The scalar scanner of the COSEVALUES_NO_SIMD build should give the same rows
+        std::string text;
+        std::vector<std::string> names;
+        for(std::size_t i = 0; i != 160; ++i) {
+            names.push_back(std::string(i % 67, 'a') + (i % 3 == 0 ? "\"" : ""));
+            text += std::to_string(1600000000 + i) + ",\t\"" + names.back()
+                + (i % 3 == 0 ? "\"" : "") + "\"," + std::string(i % 41, '1')
+                + (i % 2 == 0 ? "\r\n" : "\n");
+        }
+        text += "1,\"unterminated\n";
+        auto const reader = cosevalues::reader::from_string(text);
+        std::size_t rows = 0;
+        for(auto& row: reader.first_to_last_rows()) {
+            std::uint64_t time;
+            std::string name;
+            std::string digits;
+            if(rows == names.size()) {
+                REQUIRE_FALSE(row.parse(time, name, digits));
+            } else if(rows % 41 == 0) {
+                REQUIRE_FALSE(row.parse(time, name, digits));
+            } else {
+                REQUIRE(row.parse(time, name, digits));
+                REQUIRE_EQ(time, 1600000000 + rows);
+                REQUIRE_EQ(name, names[rows]);
+                REQUIRE_EQ(digits, std::string(rows % 41, '1'));
+            }
+            ++rows;
+        }
+        REQUIRE_EQ(rows, names.size() + 1);
+    }
+
+
+    TEST_CASE("batch_reader") {
+        auto const path = std::filesystem::temp_directory_path() / "swollencandle-batches.csv";
+        std::vector<swollencandle::trade> expected;
+        {
+            std::ofstream file{path, std::ios::binary};
+            for(std::uint64_t i = 0; i != 100000; ++i) {
+                expected.push_back({1600000000 + i, double(i % 13 + 1), 100. + double(i % 17) / 4});
+                file << expected.back().time << ',' << expected.back().price << ',' << expected.back().amount;
+                if(i + 1 != 100000)
+                    file << '\n';
+            }
+        }
+        std::error_code ec;
+        auto reader = swollencandle::batch_reader<swollencandle::trade>::from_file(path.string(), ec, 30000);
+        REQUIRE(reader);
+        std::vector<swollencandle::trade> trades;
+        std::span<swollencandle::trade const> batch;
+        std::size_t batches = 0;
+        for(;;) {
+            REQUIRE(reader->next(batch, ec));
+            if(batch.empty())
+                break;
+            REQUIRE_LE(batch.size(), 30000);
+            trades.insert(trades.end(), batch.begin(), batch.end());
+            ++batches;
+        }
+        REQUIRE(reader->next(batch, ec));
+        REQUIRE(batch.empty());
+        REQUIRE_EQ(batches, 4);
+        REQUIRE_EQ(trades, expected);
+
+        std::vector<swollencandle::candle> candles;
+        REQUIRE(swollencandle::upscale(trades, candles, swollencandle::upscale_period::minute, ec));
+        REQUIRE(swollencandle::write(path.string(), candles, ec));
+        auto candle_reader = swollencandle::batch_reader<swollencandle::candle>::from_file(path.string(), ec, 500);
+        REQUIRE(candle_reader);
+        std::size_t count = 0;
+        std::span<swollencandle::candle const> candle_batch;
+        // Error left from an earlier call does not end the loop
+        ec = swollencandle::make_error_code(swollencandle::error::mismatched_candles);
+        while(candle_reader->next(candle_batch, ec) && !candle_batch.empty()) {
+            REQUIRE_EQ(candle_batch.front().time, candles[count].time);
+            count += candle_batch.size();
+        }
+        REQUIRE_EQ(count, candles.size());
+
+        {
+            std::ofstream file{path, std::ios::binary};
+            file << "1600000000,10,1\n1600000001,x,1\n";
+        }
+        reader = swollencandle::batch_reader<swollencandle::trade>::from_file(path.string(), ec);
+        REQUIRE(reader);
+        REQUIRE_FALSE(reader->next(batch, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::invalid_trade_fields));
+        std::filesystem::remove(path);
+    }
+
+
+    TEST_CASE("upscale_file") {
+        auto const directory = std::filesystem::temp_directory_path();
+        auto const input = directory / "swollencandle-fused-trades.csv";
+        auto const output = directory / "swollencandle-fused-candles.csv";
+        std::vector<swollencandle::trade> trades;
+        for(std::uint64_t i = 0; i != 200000; ++i)
+            trades.push_back({1600000000 + i * 3, double(i % 13 + 1), 100. + double(i % 17) / 4});
+        std::error_code ec;
+        REQUIRE(swollencandle::write(input.string(), trades, ec));
+
+        swollencandle::timeframe const tf{swollencandle::upscale_period::minute, 5};
+        REQUIRE(swollencandle::upscale_file(input.string(), output.string(), tf, ec));
+        std::vector<swollencandle::candle> expected, candles;
+        REQUIRE(swollencandle::upscale(trades, expected, tf, ec));
+        REQUIRE(swollencandle::read(output.string(), candles, ec));
+        REQUIRE_EQ(candles, expected);
+
+        // Error left from an earlier call does not fail this one
+        ec = swollencandle::make_error_code(swollencandle::error::mismatched_candles);
+        REQUIRE(swollencandle::upscale_file(input.string(), output.string(), tf, ec));
+        candles.clear();
+        REQUIRE(swollencandle::read(output.string(), candles, ec));
+        REQUIRE_EQ(candles, expected);
+
+        REQUIRE_FALSE(swollencandle::upscale_file((directory / "swollencandle-missing.csv").string(),
+                                                  output.string(), tf, ec));
+        std::filesystem::remove(input);
+        std::filesystem::remove(output);
+    }
+
+
+    TEST_CASE("read_parallel") {
+        auto const path = std::filesystem::temp_directory_path() / "swollencandle-parallel.csv";
+        std::vector<swollencandle::trade> expected;
+        for(std::uint64_t i = 0; i != 300000; ++i)
+            expected.push_back({1600000000 + i, double(i % 13 + 1), 100. + double(i % 17) / 4});
+        std::error_code ec;
+        REQUIRE(swollencandle::write(path.string(), expected, ec));
+
+        std::vector<swollencandle::trade> trades;
+        REQUIRE(swollencandle::read_parallel(path.string(), trades, 4, ec));
+        REQUIRE_EQ(trades, expected);
+        REQUIRE(swollencandle::read(swollencandle::execution::par, path.string(), trades, ec));
+        REQUIRE_EQ(trades, expected);
+        REQUIRE(swollencandle::read_parallel(path.string(), trades, 0, ec));
+        REQUIRE_EQ(trades, expected);
+
+        std::vector<swollencandle::candle> candles, expected_candles;
+        REQUIRE(swollencandle::upscale(expected, expected_candles, swollencandle::upscale_period::minute, ec));
+        REQUIRE(swollencandle::write(path.string(), expected_candles, ec));
+        REQUIRE(swollencandle::read_parallel(path.string(), candles, 4, ec));
+        REQUIRE_EQ(candles, expected_candles);
+
+        // Rows before the first bad one are kept
+        {
+            std::ofstream file{path, std::ios::binary};
+            for(std::size_t i = 0; i != expected.size(); ++i) {
+                if(i == 250000 || i == 280000)
+                    file << "bad\n";
+                else
+                    file << expected[i].time << ',' << expected[i].price << ',' << expected[i].amount << '\n';
+            }
+        }
+        REQUIRE_FALSE(swollencandle::read_parallel(path.string(), trades, 4, ec));
+        REQUIRE_EQ(ec, swollencandle::make_error_code(swollencandle::error::invalid_trade_fields));
+        REQUIRE_EQ(trades.size(), 250000);
+        std::filesystem::remove(path);
+    }
+
+}
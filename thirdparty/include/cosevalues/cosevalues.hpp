@@ -25,6 +25,7 @@
 
 #include <cerrno>
 #include <charconv>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <memory>
@@ -36,9 +37,77 @@
 #include <type_traits>
 #include <vector>
 
+#if !defined(COSEVALUES_NO_SIMD) \
+    && (defined(__SSE2__) || defined(__AVX2__)) && (defined(__GNUC__) || defined(__clang__))
+#    define COSEVALUES_SIMD
+#    include <immintrin.h>
+// Block loads may leave the allocation of text within the page of its terminator,
+// so AddressSanitizer does not instrument them
+#    define COSEVALUES_BLOCK_SCAN __attribute__((no_sanitize_address))
+#endif
+
+#if !defined(COSEVALUES_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#    define COSEVALUES_MMAP
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
 
 namespace cosevalues {
 
+#ifdef COSEVALUES_SIMD
+    namespace detail {
+
+#    ifdef __AVX2__
+        using block = __m256i;
+
+        // Bit per byte of aligned block equal to one of Chars
+        template<char... Chars>
+        COSEVALUES_BLOCK_SCAN inline std::uint32_t match(char const* p) noexcept {
+            auto const bytes = _mm256_load_si256(reinterpret_cast<block const*>(p));
+            auto any = _mm256_setzero_si256();
+            ((any = _mm256_or_si256(any, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(Chars)))), ...);
+            return std::uint32_t(_mm256_movemask_epi8(any));
+        }
+#    else
+        using block = __m128i;
+
+        // Bit per byte of aligned block equal to one of Chars
+        template<char... Chars>
+        COSEVALUES_BLOCK_SCAN inline std::uint32_t match(char const* p) noexcept {
+            auto const bytes = _mm_load_si128(reinterpret_cast<block const*>(p));
+            auto any = _mm_setzero_si128();
+            ((any = _mm_or_si128(any, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(Chars)))), ...);
+            return std::uint32_t(_mm_movemask_epi8(any));
+        }
+#    endif
+
+
+        // First byte equal to one of Chars at or after p, one of them should be '\0'
+        // terminating the text. Loads are aligned, so they never cross a page
+        // boundary past the terminator
+        template<char... Chars>
+        COSEVALUES_BLOCK_SCAN inline char const* find_first_of(char const* p) noexcept {
+            auto constexpr block_size = sizeof(block);
+            auto const offset = std::uintptr_t(p) % block_size;
+            auto const* chunk = p - offset;
+            auto mask = match<Chars...>(chunk) >> offset;
+            if(mask != 0)
+                return p + __builtin_ctz(mask);
+            for(;;) {
+                chunk += block_size;
+                mask = match<Chars...>(chunk);
+                if(mask != 0)
+                    return chunk + __builtin_ctz(mask);
+            }
+        }
+
+    } // detail
+#endif
+
+
     class reader;
     
     
@@ -81,6 +150,11 @@ namespace cosevalues {
         
         
         void skip_line() noexcept {
+#ifdef COSEVALUES_SIMD
+            cursor_ = detail::find_first_of<'\n', '\0'>(cursor_);
+            if(*cursor_ == '\n')
+                ++cursor_;
+#else
             for(;;)
                 switch(*cursor_) {
                     case '\n':
@@ -90,7 +164,7 @@ namespace cosevalues {
                     default:
                         ++cursor_; continue;
                 }
-                
+#endif
         }
         
         
@@ -107,6 +181,17 @@ namespace cosevalues {
         
         bool scan_quoted(bool& has_inner_quotes) noexcept {
             ++cursor_;
+#ifdef COSEVALUES_SIMD
+            for(;;) {
+                cursor_ = detail::find_first_of<'\"', '\n', '\0'>(cursor_);
+                if(*cursor_ != '\"')
+                    return false;
+                if(*(cursor_ + 1) != '\"')
+                    return true;
+                has_inner_quotes = true;
+                cursor_ += 2;
+            }
+#else
             for(;;)
                 switch(*cursor_) {
                     case '\n': case '\0':
@@ -122,10 +207,14 @@ namespace cosevalues {
                     ++cursor_;
                     continue;
                 }
+#endif
         }
         
         
         void scan_token() noexcept {
+#ifdef COSEVALUES_SIMD
+            cursor_ = detail::find_first_of<'\t', '\r', '\n', '\0', ','>(cursor_);
+#else
             for(;;)
                 switch(*cursor_) {
                     case '\t': case '\r': case '\n': case '\0': case ',':
@@ -133,6 +222,7 @@ namespace cosevalues {
                     default:
                         ++cursor_; continue;
                 }
+#endif
         }
         
         
@@ -278,6 +368,9 @@ namespace cosevalues {
 
             row& operator * () noexcept { return fields_; }
             row* operator -> () noexcept { return &fields_; }
+
+            // Start of the current row in text
+            char const* position() const noexcept { return fields_.cursor_; }
             
             const_iterator& operator ++ () noexcept {
                 fields_.skip_line();
@@ -318,7 +411,10 @@ namespace cosevalues {
         
         
     private:
-        std::string source_;
+        // Text is followed by '\0', storage keeps it alive (string or file mapping)
+        std::shared_ptr<void const> storage_;
+        char const* text_{""};
+        size_type size_{0};
         
     public:
         
@@ -345,8 +441,16 @@ namespace cosevalues {
         reader& operator = (reader&&) noexcept = default;
         
         
+        // Regular files are memory mapped and parsed in place, others are read to string
         bool read_file(std::string const& filename,
                        std::error_code& ec) {
+#ifdef COSEVALUES_MMAP
+            bool mapped = false;
+            if(!map_file(filename, mapped, ec))
+                return false;
+            if(mapped)
+                return true;
+#endif
             auto maybe_text = read_to_string(filename, ec);
             if(!maybe_text)
                 return false;
@@ -356,30 +460,45 @@ namespace cosevalues {
 
 
         void read_string(std::string text) {
-            source_ = std::move(text);
+            auto source = std::make_shared<std::string const>(std::move(text));
+            text_ = source->data();
+            size_ = source->size();
+            storage_ = std::move(source);
         }
         
         
         size_type text_size() const noexcept {
-            return source_.size();
+            return size_;
+        }
+
+
+        std::string_view text() const noexcept {
+            return {text_, size_};
         }
 
 
         row first_row() const noexcept {
-            const_iterator begin{source_.data()};
+            const_iterator begin{text_};
             return begin.fields_;
         }
         
         
         range first_to_last_rows() const noexcept {
-            return range{const_iterator{source_.data()},
-                         const_iterator{source_.data() + source_.size()}};
+            return range{const_iterator{text_},
+                         const_iterator{text_ + size_}};
         }
         
         
+        // Rows of external '\0' terminated text, first should be at row start,
+        // last just past '\n' or at the terminating '\0'
+        static range rows_between(char const* first, char const* last) noexcept {
+            return range{const_iterator{first}, const_iterator{last}};
+        }
+
+
         range second_to_last_rows() const noexcept {
-            const_iterator end{source_.data() + source_.size()};
-            const_iterator second_line{source_.data()};
+            const_iterator end{text_ + size_};
+            const_iterator second_line{text_};
             if(second_line == end)
                 return range{end, end};
             ++second_line;
@@ -388,6 +507,52 @@ namespace cosevalues {
 
         
     private:
+
+#ifdef COSEVALUES_MMAP
+        // Zeroed anonymous pages are reserved past the end of file and the file is
+        // mapped over them, so the text is followed by '\0' even for page sized files
+        bool map_file(std::string const& filename, bool& mapped, std::error_code& ec) {
+            struct descriptor {
+                int fd;
+                ~descriptor() { if(fd != -1) ::close(fd); }
+            } const file{::open(filename.c_str(), O_RDONLY)};
+            if(file.fd == -1) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                return false;
+            }
+            struct stat status;
+            if(::fstat(file.fd, &status) == -1) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                return false;
+            }
+            if(!S_ISREG(status.st_mode) || status.st_size == 0)
+                return true;
+
+            auto const size = std::size_t(status.st_size);
+            auto const page = std::size_t(::sysconf(_SC_PAGESIZE));
+            auto const length = (size / page + 1) * page;
+            auto* const region = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(region == MAP_FAILED) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                return false;
+            }
+            if(::mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file.fd, 0) == MAP_FAILED) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                ::munmap(region, length);
+                return false;
+            }
+            ::madvise(region, size, MADV_SEQUENTIAL);
+
+            storage_ = std::shared_ptr<void const>(region, [length](void const* p) {
+                ::munmap(const_cast<void*>(p), length);
+            });
+            text_ = static_cast<char const*>(region);
+            size_ = size;
+            mapped = true;
+            return true;
+        }
+#endif
+
         
         static std::optional<std::string> read_to_string(std::string const& file_name,
                                                          std::error_code& ec) {
@@ -438,6 +603,23 @@ namespace cosevalues {
         }
 
 
+        std::size_t size() const noexcept {
+            return buffer_.size();
+        }
+
+
+        // Appends formatted text to open file and clears the buffer, capacity is kept
+        bool flush_to(FILE* file, std::error_code& ec) {
+            auto const bytes_written = fwrite(buffer_.data(), 1, buffer_.size(), file);
+            if (bytes_written != buffer_.size()) {
+                ec = std::make_error_code(static_cast<std::errc>(errno));
+                return false;
+            }
+            buffer_.clear();
+            return true;
+        }
+
+
         bool to_file(std::string const& file_name, std::error_code& ec) {
             using namespace std;
             unique_ptr<FILE, int (*)(FILE *)>
@@ -548,7 +730,7 @@ namespace cosevalues {
 
 
         void format_arg(std::int64_t arg) {
-            auto constexpr int64_digits = 19;
+            auto constexpr int64_digits = 20;
             auto p = allocate(int64_digits);
             auto const converted = std::to_chars(p, p + int64_digits, arg);
             free(converted.ptr);
@@ -556,7 +738,7 @@ namespace cosevalues {
 
 
         void format_arg(std::uint64_t arg) {
-            auto constexpr uint64_digits = 18;
+            auto constexpr uint64_digits = 20;
             auto p = allocate(uint64_digits);
             auto const converted = std::to_chars(p, p + uint64_digits, arg);
             free(converted.ptr);